@@ -3,13 +3,27 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <sched.h>
 #include <time.h>
 #include <unistd.h>
+#include <limits.h>
 #include <syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
 #include "adaptive_tpool.h"
 #include "adapter.h"
 #include "debug_macro.h"
+#include "timing_wheel.h"
+#include "fiber.h"
+#include "arrival_trace.h"
+#include "event_trace.h"
+#include "thread_budget.h"
+#include "pressure.h"
+#include "worker_metrics.h"
 
 /* ================== data structures ==================== */
 
@@ -28,27 +42,144 @@ typedef enum scaling_command
     Terminate
 } scaling_command;
 
+typedef enum job_type
+{
+    UserJob,
+    ScaleJob,
+    // start or resume a fiber
+    FiberJob
+} job_type;
+
 typedef union work_item
 {
     user_function uf;
     scaling_command sc;
+    fiber *fb;
 } work_item;
 
+typedef enum job_state
+{
+    JobQueued,
+    JobRunning,
+    // cancelled or expired
+    JobDropped
+} job_state;
+
+/**
+ * shared by a queued job and its submitter, freed when both released it
+ */
+typedef struct tpool_job_ctl
+{
+    atomic_int state;
+    atomic_int refs;
+} tpool_job_ctl;
+
+#define JOB_CACHE_LINE 64
+
 typedef struct job
 {
-    bool is_uf;
+    job_type type;
+    /** tpool_submit_job_class tag, 0 for all other jobs (this and emplaced fill the padding behind type) */
+    uint16_t job_class;
+    /** inline_arg starts with an emplace_header */
+    bool emplaced;
     work_item wi;
+    /** absolute (monotonic ms), 0 for none */
+    uint64_t deadline_ms;
+    /** NULL unless the submitter asked for a cancel handle */
+    tpool_job_ctl *ctl;
     struct job *next;
+    /** only allocated for jobs of tpool_submit_job_copy (sized to the argument), wi.uf.arg points here */
+    _Alignas(max_align_t) unsigned char inline_arg[];
 } job;
 
+_Static_assert(offsetof(job, inline_arg) + TPOOL_INLINE_ARG_SIZE == JOB_CACHE_LINE,
+               "inline arguments fill up the cache line of a job node");
+
+/**
+ * front of the inline argument of tpool_submit_job_emplace jobs
+ */
+typedef struct emplace_header
+{
+    tfunc dispose;
+    _Alignas(max_align_t) unsigned char arg[];
+} emplace_header;
+
+/* ------------ worker state --------------*/
+typedef struct arena_overflow
+{
+    struct arena_overflow *next;
+} arena_overflow;
+
+typedef struct worker_state
+{
+    struct tpool *tp;
+    /** result of the worker_init hook */
+    void *local;
+    unsigned char *arena;
+    size_t arena_size;
+    size_t arena_used;
+    /** allocations that did not fit into the arena, freed with the next reset */
+    arena_overflow *overflow;
+    /** /proc/thread-self/io, -1 unless class accounting is enabled and available */
+    int io_fd;
+    tpool_class_metrics classes[TPOOL_MAX_CLASSES];
+} worker_state;
+
+/* ------------ idle workers --------------*/
+// fixed point 1.0 of a worker's spin hit rate
+#define SPIN_RATE_ONE 256
+// longest pause run between two checks of the queue
+#define SPIN_BACKOFF_MAX 64
+// parked workers still wake up this often for scaling advice and metrics
+#define PARK_TIMEOUT_MS 1000
+
 typedef struct jobqueue
 {
     pthread_spinlock_t lock;
     job *first;
     job *last;
+    /** includes the jobs waiting in the deferred lists of the classes */
     size_t size;
+    /** jobs in the deferred lists of all classes */
+    size_t deferred;
+    /** 0 for unbounded */
+    size_t capacity;
+    size_t high_water;
+    /** futex word, bumped on every pop so blocked submitters can recheck */
+    uint32_t not_full;
+    uint32_t waiting_submitters;
+    /** futex word, bumped on every push so parked workers can recheck */
+    _Atomic uint32_t not_empty;
+    _Atomic uint32_t parked_workers;
 } jobqueue;
 
+/* ------------ strands --------------*/
+// jobs a strand runs in one go before it requeues itself, keeps busy strands from hogging a worker
+#define STRAND_BATCH 32
+
+typedef struct strand_node
+{
+    _Atomic(struct strand_node *) next;
+    /** NULL marks the destroy request */
+    tfunc f;
+    void *arg;
+} strand_node;
+
+/**
+ * intrusive multi-producer single-consumer queue (Vyukov), producers never wait,
+ * the consumer is whichever worker currently runs the strand
+ */
+typedef struct tpool_strand_t
+{
+    struct tpool *tp;
+    _Atomic(strand_node *) tail;
+    strand_node *head;
+    strand_node stub;
+    /** submitted but not yet executed jobs, the 0 -> 1 transition schedules the strand */
+    atomic_size_t pending;
+} tpool_strand_t;
+
 /* ------------ pool + workers --------------*/
 typedef struct worker
 {
@@ -66,6 +197,59 @@ typedef struct worker_list
     size_t max_id;
 } worker_list;
 
+/* ------------ delayed jobs --------------*/
+typedef struct timer_service
+{
+    /** guards the wheel, timer thread holds it while handing out due jobs */
+    pthread_mutex_t lock;
+    /** signalled when a timer is added or the pool stops */
+    pthread_cond_t cond;
+    timing_wheel wheel;
+    pthread_t thread;
+    /** timer thread is only started on first delayed submit */
+    bool running;
+} timer_service;
+
+/* ------------ fiber jobs --------------*/
+typedef struct fiber_poller
+{
+    /** guards lazy start, the fds while registering and the awaiting list */
+    pthread_mutex_t lock;
+    int epoll_fd;
+    /** registered with ptr NULL, written to stop the poller */
+    int wake_fd;
+    pthread_t thread;
+    bool running;
+    /** jobs of fibers registered with epoll, linked through their fibers, freed by tpool_destroy if never woken */
+    job *awaiting;
+} fiber_poller;
+
+/* ------------ arrival recording --------------*/
+// distinct job functions that get their own class in an arrival trace, further ones share the last class
+#define MAX_ARRIVAL_CLASSES 64
+
+typedef struct arrival_recorder
+{
+    /** checked without the lock on every submit, NULL while not recording */
+    _Atomic(arrival_writer *) writer;
+    pthread_mutex_t lock;
+    /** job functions in order of first arrival, index is the recorded class */
+    tfunc classes[MAX_ARRIVAL_CLASSES];
+    size_t num_classes;
+} arrival_recorder;
+
+/* ------------ job classes --------------*/
+typedef struct job_class_state
+{
+    /** jobs of the class dequeued and not yet finished */
+    atomic_size_t running;
+    /** 0 for no limit */
+    atomic_size_t limit;
+    /** FIFO of jobs that reached the queue head while the class was at its limit, guarded by the jobqueue lock */
+    job *deferred_first;
+    job *deferred_last;
+} job_class_state;
+
 typedef struct tpool
 {
     jobqueue jobqueue;
@@ -73,6 +257,8 @@ typedef struct tpool
     pthread_spinlock_t count_lock;
     volatile size_t num_threads;
     volatile size_t num_busy_threads;
+    /** fibers parked in the poller, neither queued nor running */
+    volatile size_t num_suspended_fibers;
     /** true once destroy call has been issued */
     bool stopping;
     worker_list workers;
@@ -80,6 +266,28 @@ typedef struct tpool
     /** pid of the process that created the pool,
      * for logging purposes */
     pid_t creator_pid;
+    timer_service timers;
+    fiber_pool fibers;
+    fiber_poller poller;
+    arrival_recorder arrivals;
+    /** NULL unless event tracing is configured */
+    event_recorder *events;
+    /** jobs dropped at dequeue */
+    atomic_size_t jobs_cancelled;
+    atomic_size_t jobs_expired;
+    /** NULL unless the pool shares a thread budget with other pools */
+    thread_budget *budget;
+    /** NULL unless the pool is pressure aware and a pressure source exists */
+    pressure_governor *pressure;
+    /** only counted while a budget or the pressure governor needs the throughput */
+    _Atomic uint64_t jobs_completed;
+    /** outcome of idle spinning, summed over all workers */
+    atomic_size_t spin_hits;
+    atomic_size_t spin_misses;
+    atomic_size_t spin_pauses;
+    atomic_size_t arena_overflows;
+    job_class_state classes[TPOOL_MAX_CLASSES];
+    tpool_config config;
 } tpool;
 
 typedef struct worker_args
@@ -90,14 +298,34 @@ typedef struct worker_args
 
 /* ==================== Prototypes ==================== */
 
-static void init_jobqueue(jobqueue *jq);
+static void init_jobqueue(jobqueue *jq, size_t capacity);
+
+static void notify_not_full(jobqueue *jq);
+
+static bool push_bounded(tpool *tpool_ptr, job *new_job);
 
 static job *pop_next_job(jobqueue *jq);
 
+static job *pop_runnable_job(tpool *tpool_ptr);
+
+static bool class_admits(tpool *tpool_ptr, uint32_t job_class);
+
+static void defer_job(tpool *tpool_ptr, job *deferred);
+
+static void release_class(tpool *tpool_ptr, uint32_t job_class);
+
+static void park_until_admitted(tpool *tpool_ptr, uint32_t seen);
+
 static void push_new_job(jobqueue *jq, job *new_job);
 
 static job *create_user_job(tfunc ufunc, void *uarg);
 
+static job *create_inline_job(tfunc ufunc, size_t len);
+
+static job *create_copy_job(tfunc ufunc, const void *arg_bytes, size_t len);
+
+static bool submit_user_job(tpool *tpool_ptr, job *new_job);
+
 static job *create_scale_job(scaling_command sc);
 
 static void check_scaling(tpool *tp, size_t wid);
@@ -110,46 +338,228 @@ static void add_extra_worker(tpool *tpool_ptr);
 
 static void remove_worker(size_t worker_id, tpool *tpool_ptr);
 
+static bool init_timer_service(timer_service *ts);
+
+static tpool_timer add_timer(tpool *tpool_ptr, uint64_t delay_ms, uint64_t period_ms, tfunc f, void *arg);
+
+static void stop_timer_service(tpool *tpool_ptr);
+
+static void timer_function(tpool *tpool_ptr);
+
+static void enqueue_due_job(tfunc f, void *arg, void *ctx);
+
+static uint64_t monotonic_time_ms();
+
+static job *create_fiber_job(tpool *tpool_ptr, tfunc ufunc, void *uarg);
+
+static void run_fiber(tpool *tpool_ptr, job *fiber_job);
+
+static void fiber_entry(void);
+
+static void push_internal_job(tpool *tpool_ptr, job *internal_job);
+
+static void await_in_poller(tpool *tpool_ptr, job *fiber_job);
+
+static bool start_poller(tpool *tpool_ptr);
+
+static void unlink_awaiting(fiber_poller *fp, job *fiber_job);
+
+static void stop_poller(tpool *tpool_ptr);
+
+static void poller_function(tpool *tpool_ptr);
+
+static void free_job(tpool *tpool_ptr, job *to_free);
+
+static void drop_queued_jobs(tpool *tpool_ptr);
+
+static void drop_strand(tpool_strand_t *strand);
+
+static bool claim_job(tpool *tpool_ptr, job *user_job);
+
+static void release_job_ctl(tpool_job_ctl *ctl);
+
+static void strand_push(tpool_strand_t *strand, strand_node *node);
+
+static strand_node *strand_pop(tpool_strand_t *strand);
+
+static bool strand_enqueue(tpool_strand_t *strand, tfunc f, void *arg);
+
+static void schedule_strand(tpool_strand_t *strand);
+
+static void run_strand(void *arg);
+
+static void record_arrival(tpool *tpool_ptr, tfunc f);
+
+static void report_metrics(tpool *tpool_ptr, worker_state *state, size_t wid, uint64_t *last_sample_ms, bool final);
+
+static void record_event(tpool *tpool_ptr, event_type type, uint64_t arg, int64_t value);
+
+static void cpu_relax();
+
+static bool spin_for_job(tpool *tpool_ptr, uint32_t *hit_rate);
+
+static void park_for_job(tpool *tpool_ptr);
+
+static void notify_not_empty(jobqueue *jq, int amount);
+
+static void init_worker_state(tpool *tpool_ptr, worker_state *state, size_t wid);
+
+static void reset_arena(worker_state *state);
+
+static void account_job(worker_state *state, uint32_t job_class, uint64_t start_ns, const tpool_worker_metrics *io_before);
+
+static uint64_t monotonic_time_ns();
+
+/* ==================== Thread locals ==================== */
+
+/** context of the worker loop, fibers switch back to it when they suspend or finish */
+static __thread ucontext_t scheduler_ctx;
+/** fiber currently running on this thread, NULL outside of fiber jobs */
+static __thread fiber *running_fiber;
+/** state of the worker running on this thread, NULL on threads that are not workers */
+static __thread worker_state *current_worker;
+
 /* ====================== API ====================== */
 
 tpool *tpool_create(size_t size, AdapterParameters *adaptor_params, const char *adapter_algo_params)
+{
+    tpool_config config;
+    tpool_config_init(&config, size);
+    config.adapter_params = adaptor_params;
+    config.adapter_algo_params = adapter_algo_params;
+    return tpool_create_with_config(&config);
+}
+
+void tpool_config_init(tpool_config *config, size_t size)
+{
+    config->size = size;
+    config->adapter_params = NULL;
+    config->adapter_algo_params = NULL;
+    config->queue_capacity = 0;
+    config->overflow_mode = TPOOL_OVERFLOW_BLOCK;
+    config->fiber_stack_size = TPOOL_DEFAULT_FIBER_STACK;
+    config->metrics_callback = NULL;
+    config->metrics_ctx = NULL;
+    config->metrics_interval_ms = 1000;
+    config->trace_buffer_events = 0;
+    config->trace_path = NULL;
+    config->drop_callback = NULL;
+    config->drop_ctx = NULL;
+    config->budget_name = NULL;
+    config->budget_threads = 0;
+    config->spin_min = TPOOL_DEFAULT_SPIN_MIN;
+    config->spin_max = TPOOL_DEFAULT_SPIN_MAX;
+    config->worker_init = NULL;
+    config->worker_exit = NULL;
+    config->worker_ctx = NULL;
+    config->arena_size = 0;
+    config->pressure_aware = false;
+    config->pressure_interval_ms = 1000;
+    config->quota_threads_per_cpu = 1.0;
+    config->io_pressure_max = 0.5;
+    config->memory_pressure_max = 0.2;
+    config->class_accounting = false;
+    memset(config->class_limits, 0, sizeof(config->class_limits));
+}
+
+tpool *tpool_create_with_config(const tpool_config *config)
 {
     tpool *tpool_ptr;
+    size_t size = config->size;
     // initialize thread pool structure
     tpool_ptr = malloc(sizeof(tpool));
     if (tpool_ptr == NULL)
     {
         return NULL;
     }
-    tpool_ptr->creator_pid = syscall(__NR_gettid);
-    if (adaptor_params == NULL)
+    tpool_ptr->config = *config;
+    // on a single cpu the spinning worker only delays the thread that would submit the job
+    if (sysconf(_SC_NPROCESSORS_ONLN) <= 1)
     {
-        tpool_ptr->is_static = true;
+        tpool_ptr->config.spin_max = 0;
     }
-    else
+    tpool_ptr->creator_pid = syscall(__NR_gettid);
+    tpool_ptr->is_static = config->adapter_params == NULL;
+    if (!tpool_ptr->is_static && !new_adapter(config->adapter_params, config->adapter_algo_params))
     {
-        if (!new_adapter(adaptor_params, adapter_algo_params))
-        {
-            free(tpool_ptr);
-            return NULL;
-        }
-        tpool_ptr->is_static = false;
+        free(tpool_ptr);
+        return NULL;
     }
     // initialize all spinlocks
-    if (pthread_spin_init(&tpool_ptr->count_lock, PTHREAD_PROCESS_PRIVATE) + pthread_spin_init(&tpool_ptr->jobqueue.lock, PTHREAD_PROCESS_PRIVATE) + pthread_spin_init(&tpool_ptr->workers.lock, PTHREAD_PROCESS_PRIVATE) != 0)
+    if (pthread_spin_init(&tpool_ptr->count_lock, PTHREAD_PROCESS_PRIVATE) != 0)
     {
-        // TODO: proper error handling
-        return NULL;
+        goto fail_adapter;
+    }
+    if (pthread_spin_init(&tpool_ptr->jobqueue.lock, PTHREAD_PROCESS_PRIVATE) != 0)
+    {
+        goto fail_count_lock;
+    }
+    if (pthread_spin_init(&tpool_ptr->workers.lock, PTHREAD_PROCESS_PRIVATE) != 0)
+    {
+        goto fail_queue_lock;
     }
 
-    init_jobqueue(&(tpool_ptr->jobqueue));
-    if (&(tpool_ptr->jobqueue) == NULL)
+    init_jobqueue(&(tpool_ptr->jobqueue), config->queue_capacity);
+    if (!init_timer_service(&tpool_ptr->timers))
     {
-        free(tpool_ptr);
-        return NULL;
+        goto fail_workers_lock;
+    }
+    // stacks are only mapped once the first fiber job is submitted
+    if (!fiber_pool_init(&tpool_ptr->fibers, config->fiber_stack_size))
+    {
+        goto fail_timers;
+    }
+    if (pthread_mutex_init(&tpool_ptr->poller.lock, NULL) != 0)
+    {
+        goto fail_fibers;
     }
+    tpool_ptr->poller.running = false;
+    tpool_ptr->poller.awaiting = NULL;
+    atomic_init(&tpool_ptr->arrivals.writer, NULL);
+    if (pthread_mutex_init(&tpool_ptr->arrivals.lock, NULL) != 0)
+    {
+        goto fail_poller_lock;
+    }
+    tpool_ptr->arrivals.num_classes = 0;
+    atomic_init(&tpool_ptr->jobs_cancelled, 0);
+    atomic_init(&tpool_ptr->jobs_expired, 0);
+    atomic_init(&tpool_ptr->spin_hits, 0);
+    atomic_init(&tpool_ptr->spin_misses, 0);
+    atomic_init(&tpool_ptr->spin_pauses, 0);
+    atomic_init(&tpool_ptr->arena_overflows, 0);
+    for (size_t i = 0; i < TPOOL_MAX_CLASSES; i++)
+    {
+        atomic_init(&tpool_ptr->classes[i].running, 0);
+        atomic_init(&tpool_ptr->classes[i].limit, i > 0 ? config->class_limits[i] : 0);
+        tpool_ptr->classes[i].deferred_first = NULL;
+        tpool_ptr->classes[i].deferred_last = NULL;
+    }
+    tpool_ptr->events = NULL;
+    if (config->trace_buffer_events > 0)
+    {
+        tpool_ptr->events = event_recorder_create(config->trace_buffer_events);
+        if (tpool_ptr->events == NULL)
+        {
+            goto fail_arrivals_lock;
+        }
+    }
+    tpool_ptr->budget = NULL;
+    atomic_init(&tpool_ptr->jobs_completed, 0);
+    // a static pool never scales, there is nothing to arbitrate
+    if (config->budget_name != NULL && !tpool_ptr->is_static)
+    {
+        tpool_ptr->budget = thread_budget_join(config->budget_name, config->budget_threads);
+        if (tpool_ptr->budget == NULL)
+        {
+            goto fail_events;
+        }
+    }
+    // without psi and cpu quota the pool just scales on the adapter's advice
+    tpool_ptr->pressure = config->pressure_aware && !tpool_ptr->is_static ? pressure_governor_create(config) : NULL;
     debug_print("queue initialized: %d\n", tpool_ptr->jobqueue.lock);
     tpool_ptr->num_threads = size;
+    tpool_ptr->num_busy_threads = 0;
+    tpool_ptr->num_suspended_fibers = 0;
     tpool_ptr->stopping = false;
 
     // create worker threads
@@ -185,385 +595,1926 @@ tpool *tpool_create(size_t size, AdapterParameters *adaptor_params, const char *
     }
     tpool_ptr->workers.last = current;
     return tpool_ptr;
+
+    // unwind in reverse order of initialization, each label undoes one step
+fail_events:
+    if (tpool_ptr->events != NULL)
+    {
+        event_recorder_destroy(tpool_ptr->events);
+    }
+fail_arrivals_lock:
+    pthread_mutex_destroy(&tpool_ptr->arrivals.lock);
+fail_poller_lock:
+    pthread_mutex_destroy(&tpool_ptr->poller.lock);
+fail_fibers:
+    fiber_pool_destroy(&tpool_ptr->fibers);
+fail_timers:
+    stop_timer_service(tpool_ptr);
+fail_workers_lock:
+    pthread_spin_destroy(&tpool_ptr->workers.lock);
+fail_queue_lock:
+    pthread_spin_destroy(&tpool_ptr->jobqueue.lock);
+fail_count_lock:
+    pthread_spin_destroy(&tpool_ptr->count_lock);
+fail_adapter:
+    if (!tpool_ptr->is_static)
+    {
+        close_adapter();
+    }
+    free(tpool_ptr);
+    return NULL;
 }
 
 bool tpool_submit_job(tpool *tpool_ptr, tfunc tfunc_ptr, void *tfunc_arg_ptr)
+{
+    return tpool_submit_job_until(tpool_ptr, 0, tfunc_ptr, tfunc_arg_ptr, NULL);
+}
+
+bool tpool_submit_job_until(tpool *tpool_ptr, uint64_t deadline_ms, tfunc tfunc_ptr, void *tfunc_arg_ptr,
+                            tpool_job_handle *handle)
 {
     if (tfunc_ptr == NULL)
     {
         return false;
     }
+    record_arrival(tpool_ptr, tfunc_ptr);
+    record_event(tpool_ptr, EventSubmit, (uint64_t)tfunc_ptr, tpool_ptr->jobqueue.size);
     // create job
     job *new_job_ptr = create_user_job(tfunc_ptr, tfunc_arg_ptr);
     if (new_job_ptr == NULL)
     {
         return false;
     }
-    jobqueue *jobqueue_ptr = &(tpool_ptr->jobqueue);
-    // grab lock on jobqueue
-    pthread_spin_lock(&jobqueue_ptr->lock);
-    // push job to queue
-    push_new_job(jobqueue_ptr, new_job_ptr);
-    // release lock
-    pthread_spin_unlock(&jobqueue_ptr->lock);
+    new_job_ptr->deadline_ms = deadline_ms;
+    tpool_job_ctl *ctl = NULL;
+    if (handle != NULL)
+    {
+        ctl = malloc(sizeof(tpool_job_ctl));
+        if (ctl == NULL)
+        {
+            free(new_job_ptr);
+            return false;
+        }
+        atomic_init(&ctl->state, JobQueued);
+        // one reference for the job, one for the submitter
+        atomic_init(&ctl->refs, 2);
+        new_job_ptr->ctl = ctl;
+    }
+    if (!submit_user_job(tpool_ptr, new_job_ptr))
+    {
+        // the rejected job released its reference, this drops the submitter's
+        if (ctl != NULL)
+            release_job_ctl(ctl);
+        return false;
+    }
+    if (handle != NULL)
+    {
+        *handle = ctl;
+    }
     return true;
 }
 
-/*
- * spins until all currently submitted jobs have been finished
- * no guarantee about jobs that are submitted after the call
- */
-void tpool_wait(tpool *tpool_ptr)
+bool tpool_submit_job_class(tpool *tpool_ptr, uint32_t job_class, tfunc tfunc_ptr, void *tfunc_arg_ptr)
 {
-    // while there are still busy threads or the jobqueue is not empty wait
-    while (tpool_ptr->num_busy_threads != 0 || tpool_ptr->jobqueue.size != 0)
+    if (tfunc_ptr == NULL || job_class >= TPOOL_MAX_CLASSES)
     {
-        sleep(1);
+        return false;
+    }
+    record_arrival(tpool_ptr, tfunc_ptr);
+    record_event(tpool_ptr, EventSubmit, (uint64_t)tfunc_ptr, tpool_ptr->jobqueue.size);
+    job *new_job_ptr = create_user_job(tfunc_ptr, tfunc_arg_ptr);
+    if (new_job_ptr == NULL)
+    {
+        return false;
     }
+    new_job_ptr->job_class = job_class;
+    return submit_user_job(tpool_ptr, new_job_ptr);
 }
 
-void tpool_destroy(tpool *tpool_ptr)
+bool tpool_set_class_limit(tpool *tpool_ptr, uint32_t job_class, size_t limit)
 {
-    if (tpool_ptr == NULL)
-        return;
-
-    jobqueue queue = tpool_ptr->jobqueue;
-    tpool_ptr->stopping = true;
-
-    // lock work queue and clear it
-    pthread_spin_lock(&queue.lock);
-    job *to_free = queue.first;
-    while (to_free != NULL)
+    if (job_class == 0 || job_class >= TPOOL_MAX_CLASSES)
     {
-        job *new_to_free = to_free->next;
-        free(to_free);
-        to_free = new_to_free;
+        return false;
     }
-    queue.size = 0;
-    pthread_spin_unlock(&queue.lock);
-
-    // wait for all threads to be idle (in this case all must have exited)
-    tpool_wait(tpool_ptr);
-    // free datastructures
-    free(tpool_ptr);
+    atomic_store(&tpool_ptr->classes[job_class].limit, limit);
+    // workers parked on a full class recheck, a raised limit may admit their jobs
+    atomic_fetch_add(&tpool_ptr->jobqueue.not_empty, 1);
+    notify_not_empty(&tpool_ptr->jobqueue, INT_MAX);
+    return true;
 }
 
-// NO ERROR HANDLING YET
-bool tpool_scale(tpool *tp, int diff)
+bool tpool_submit_job_copy(tpool *tpool_ptr, tfunc tfunc_ptr, const void *arg_bytes, size_t len)
 {
-    // don't go below one worker thread
-    if (tp->num_threads + diff <= 0)
+    if (tfunc_ptr == NULL)
     {
-        debug_print("%s\n", "scaling down would drop below 1 worker, only scale down to 1 worker");
-        diff = 1 - tp->num_threads;
+        return false;
     }
-    // don't go above max worker amount
-    else if (tp->num_threads + diff > MAX_SIZE)
+    record_arrival(tpool_ptr, tfunc_ptr);
+    record_event(tpool_ptr, EventSubmit, (uint64_t)tfunc_ptr, tpool_ptr->jobqueue.size);
+    job *new_job_ptr = create_copy_job(tfunc_ptr, arg_bytes, len);
+    if (new_job_ptr == NULL)
     {
-        debug_print("%s\n", "scaling up would go above max amount workers, only scale to max");
-        diff = MAX_SIZE - tp->num_threads;
+        return false;
     }
-    // grab lock on jobqueue
-    debug_print("tpool (creator pid: %d) scaling to %d\n", tp->creator_pid, ((int) tp->num_threads) + diff);
-    pthread_spin_lock(&tp->jobqueue.lock);
-    if (diff < 0)
+    return submit_user_job(tpool_ptr, new_job_ptr);
+}
+
+bool tpool_submit_job_emplace(tpool *tpool_ptr, tfunc tfunc_ptr, size_t len, tpool_arg_init_fn init, void *ctx,
+                              tfunc dispose)
+{
+    if (tfunc_ptr == NULL || init == NULL)
     {
-        while (diff < 0)
-        {
-            push_scale_job(&tp->jobqueue, Terminate);
-            diff++;
-        }
+        return false;
     }
-    else
+    record_arrival(tpool_ptr, tfunc_ptr);
+    record_event(tpool_ptr, EventSubmit, (uint64_t)tfunc_ptr, tpool_ptr->jobqueue.size);
+    job *new_job_ptr = create_inline_job(tfunc_ptr, offsetof(emplace_header, arg) + len);
+    if (new_job_ptr == NULL)
     {
-        while (diff > 0)
-        {
-            push_scale_job(&tp->jobqueue, Clone);
-            diff--;
-        }
+        return false;
     }
-    // release lock
-    pthread_spin_unlock(&tp->jobqueue.lock);
-    return true;
+    emplace_header *header = (emplace_header *)new_job_ptr->inline_arg;
+    header->dispose = dispose;
+    new_job_ptr->emplaced = true;
+    new_job_ptr->wi.uf.arg = header->arg;
+    init(header->arg, ctx);
+    return submit_user_job(tpool_ptr, new_job_ptr);
 }
 
-/* =================== Internal ===================== */
-
-static job *create_user_job(tfunc ufunc, void *uarg)
+bool tpool_cancel_job(tpool_job_handle handle)
 {
-    job *new_job = malloc(sizeof(job));
-    if (new_job == NULL)
-    {
-        return NULL;
-    }
-    new_job->next = NULL;
-    new_job->is_uf = true;
-    new_job->wi.uf.f = ufunc;
-    new_job->wi.uf.arg = uarg;
-    return new_job;
+    int expected = JobQueued;
+    // the dequeueing worker does the same transition to JobRunning, only one of them wins
+    return atomic_compare_exchange_strong(&handle->state, &expected, JobDropped);
 }
 
-static job *create_scale_job(scaling_command sc)
+void tpool_job_release(tpool_job_handle handle)
 {
-    job *new_job = malloc(sizeof(job));
-    if (new_job == NULL)
-    {
-        return NULL;
-    }
-    new_job->next = NULL;
-    new_job->is_uf = false;
-    new_job->wi.sc = sc;
-    return new_job;
+    release_job_ctl(handle);
 }
 
-static void init_jobqueue(jobqueue *jq)
+void *tpool_worker_local(void)
 {
-    if (jq == NULL)
-    {
-        return;
-    }
-    jq->first = NULL;
-    jq->last = NULL;
-    jq->size = 0;
+    return current_worker != NULL ? current_worker->local : NULL;
 }
 
-/*
- * pops the head of the jobqueue
- */
-static job *pop_next_job(jobqueue *jq)
+void *tpool_arena_alloc(size_t size, size_t alignment)
 {
-    debug_print("%s", "pop\n");
-    job *head = jq->first;
-    if (head == NULL)
+    worker_state *state = current_worker;
+    if (state == NULL)
     {
         return NULL;
     }
-    // update head (may be NULL if list empty now)
-    jq->first = head->next;
-    // update last if list empty now
-    if (jq->first == NULL)
+    if (alignment == 0)
     {
-        jq->last = NULL;
+        alignment = _Alignof(max_align_t);
     }
-    // update size
+    // the worker's arena is reset after every slice, a suspended fiber may resume on another worker
+    if (running_fiber != NULL)
+    {
+        return fiber_alloc(running_fiber, size, alignment);
+    }
+    if (state->arena != NULL)
+    {
+        uintptr_t base = (uintptr_t)state->arena;
+        size_t offset = ((base + state->arena_used + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+        if (offset <= state->arena_size && size <= state->arena_size - offset)
+        {
+            state->arena_used = offset + size;
+            return state->arena + offset;
+        }
+    }
+    arena_overflow *block = malloc(sizeof(arena_overflow) + alignment - 1 + size);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+    block->next = state->overflow;
+    state->overflow = block;
+    atomic_fetch_add_explicit(&state->tp->arena_overflows, 1, memory_order_relaxed);
+    return (void *)(((uintptr_t)(block + 1) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+uint64_t tpool_now_ms(void)
+{
+    return monotonic_time_ms();
+}
+
+bool tpool_submit_fiber(tpool *tpool_ptr, tfunc tfunc_ptr, void *tfunc_arg_ptr)
+{
+    if (tfunc_ptr == NULL)
+    {
+        return false;
+    }
+    record_arrival(tpool_ptr, tfunc_ptr);
+    record_event(tpool_ptr, EventSubmit, (uint64_t)tfunc_ptr, tpool_ptr->jobqueue.size);
+    job *new_job_ptr = create_fiber_job(tpool_ptr, tfunc_ptr, tfunc_arg_ptr);
+    if (new_job_ptr == NULL)
+    {
+        return false;
+    }
+    jobqueue *jobqueue_ptr = &(tpool_ptr->jobqueue);
+    if (jobqueue_ptr->capacity != 0)
+    {
+        return push_bounded(tpool_ptr, new_job_ptr);
+    }
+    pthread_spin_lock(&jobqueue_ptr->lock);
+    push_new_job(jobqueue_ptr, new_job_ptr);
+    pthread_spin_unlock(&jobqueue_ptr->lock);
+    notify_not_empty(jobqueue_ptr, 1);
+    return true;
+}
+
+bool tpool_yield(void)
+{
+    // read before switching, the fiber may be resumed on another thread
+    fiber *fb = running_fiber;
+    if (fb == NULL)
+    {
+        return false;
+    }
+    fb->state = FiberYielded;
+    swapcontext(&fb->ctx, fb->caller);
+    return true;
+}
+
+bool tpool_await_fd(int fd, uint32_t events)
+{
+    fiber *fb = running_fiber;
+    if (fb == NULL)
+    {
+        return false;
+    }
+    fb->state = FiberAwaiting;
+    fb->await_fd = fd;
+    fb->await_events = events;
+    // registration happens on the worker side once this context is saved
+    swapcontext(&fb->ctx, fb->caller);
+    return true;
+}
+
+tpool_strand tpool_strand_create(tpool *tpool_ptr)
+{
+    tpool_strand_t *strand = malloc(sizeof(tpool_strand_t));
+    if (strand == NULL)
+    {
+        return NULL;
+    }
+    strand->tp = tpool_ptr;
+    atomic_init(&strand->stub.next, NULL);
+    atomic_init(&strand->tail, &strand->stub);
+    strand->head = &strand->stub;
+    atomic_init(&strand->pending, 0);
+    return strand;
+}
+
+bool tpool_strand_submit(tpool_strand strand, tfunc tfunc_ptr, void *tfunc_arg_ptr)
+{
+    if (tfunc_ptr == NULL)
+    {
+        return false;
+    }
+    record_arrival(strand->tp, tfunc_ptr);
+    record_event(strand->tp, EventSubmit, (uint64_t)tfunc_ptr, strand->tp->jobqueue.size);
+    return strand_enqueue(strand, tfunc_ptr, tfunc_arg_ptr);
+}
+
+void tpool_strand_destroy(tpool_strand strand)
+{
+    // the destroy request is ordered behind all jobs submitted before
+    while (!strand_enqueue(strand, NULL, NULL))
+    {
+        sched_yield();
+    }
+}
+
+bool tpool_record_arrivals(tpool *tpool_ptr, const char *path)
+{
+    arrival_recorder *recorder = &tpool_ptr->arrivals;
+    pthread_mutex_lock(&recorder->lock);
+    if (atomic_load(&recorder->writer) != NULL)
+    {
+        pthread_mutex_unlock(&recorder->lock);
+        return false;
+    }
+    arrival_writer *writer = arrival_writer_open(path);
+    recorder->num_classes = 0;
+    atomic_store(&recorder->writer, writer);
+    pthread_mutex_unlock(&recorder->lock);
+    return writer != NULL;
+}
+
+void tpool_stop_recording_arrivals(tpool *tpool_ptr)
+{
+    arrival_recorder *recorder = &tpool_ptr->arrivals;
+    pthread_mutex_lock(&recorder->lock);
+    arrival_writer *writer = atomic_exchange(&recorder->writer, NULL);
+    pthread_mutex_unlock(&recorder->lock);
+    if (writer != NULL)
+    {
+        debug_print("recorded %zu arrivals\n", writer->recorded);
+        arrival_writer_close(writer);
+    }
+}
+
+tpool_timer tpool_submit_after(tpool *tpool_ptr, uint64_t delay_ms, tfunc tfunc_ptr, void *tfunc_arg_ptr)
+{
+    if (tfunc_ptr == NULL)
+    {
+        return 0;
+    }
+    return add_timer(tpool_ptr, delay_ms, 0, tfunc_ptr, tfunc_arg_ptr);
+}
+
+tpool_timer tpool_submit_every(tpool *tpool_ptr, uint64_t period_ms, tfunc tfunc_ptr, void *tfunc_arg_ptr)
+{
+    if (tfunc_ptr == NULL || period_ms == 0)
+    {
+        return 0;
+    }
+    return add_timer(tpool_ptr, period_ms, period_ms, tfunc_ptr, tfunc_arg_ptr);
+}
+
+bool tpool_cancel_timer(tpool *tpool_ptr, tpool_timer timer)
+{
+    timer_service *ts = &tpool_ptr->timers;
+    pthread_mutex_lock(&ts->lock);
+    bool cancelled = tw_cancel(&ts->wheel, timer);
+    pthread_mutex_unlock(&ts->lock);
+    return cancelled;
+}
+
+/*
+ * spins until all currently submitted jobs have been finished
+ * no guarantee about jobs that are submitted after the call
+ */
+void tpool_wait(tpool *tpool_ptr)
+{
+    // while there are still busy threads or the jobqueue is not empty wait
+    while (tpool_ptr->num_busy_threads != 0 || tpool_ptr->jobqueue.size != 0 || tpool_ptr->num_suspended_fibers != 0)
+    {
+        sleep(1);
+    }
+}
+
+void tpool_get_stats(tpool *tpool_ptr, tpool_stats *stats)
+{
+    pthread_spin_lock(&tpool_ptr->count_lock);
+    stats->num_threads = tpool_ptr->num_threads;
+    stats->num_busy_threads = tpool_ptr->num_busy_threads;
+    pthread_spin_unlock(&tpool_ptr->count_lock);
+    pthread_spin_lock(&tpool_ptr->jobqueue.lock);
+    stats->queue_depth = tpool_ptr->jobqueue.size;
+    stats->queue_high_water = tpool_ptr->jobqueue.high_water;
+    pthread_spin_unlock(&tpool_ptr->jobqueue.lock);
+    stats->jobs_cancelled = atomic_load(&tpool_ptr->jobs_cancelled);
+    stats->jobs_expired = atomic_load(&tpool_ptr->jobs_expired);
+    stats->budget_share = tpool_ptr->budget != NULL ? atomic_load(&tpool_ptr->budget->allowed) : 0;
+    stats->spin_hits = atomic_load(&tpool_ptr->spin_hits);
+    stats->spin_misses = atomic_load(&tpool_ptr->spin_misses);
+    stats->spin_pauses = atomic_load(&tpool_ptr->spin_pauses);
+    stats->arena_overflows = atomic_load(&tpool_ptr->arena_overflows);
+    size_t pressure_cap = tpool_ptr->pressure != NULL ? atomic_load(&tpool_ptr->pressure->cap) : SIZE_MAX;
+    stats->pressure_cap = pressure_cap != SIZE_MAX ? pressure_cap : 0;
+    for (size_t i = 0; i < TPOOL_MAX_CLASSES; i++)
+    {
+        stats->class_running[i] = atomic_load(&tpool_ptr->classes[i].running);
+    }
+}
+
+bool tpool_dump_trace(tpool *tpool_ptr, const char *path)
+{
+    if (tpool_ptr->events == NULL)
+    {
+        return false;
+    }
+    return event_recorder_dump_json(tpool_ptr->events, path);
+}
+
+void tpool_destroy(tpool *tpool_ptr)
+{
+    if (tpool_ptr == NULL)
+        return;
+
+    jobqueue *queue = &tpool_ptr->jobqueue;
+    tpool_ptr->stopping = true;
+    // no more due jobs or woken fibers must be queued after the queue is cleared
+    stop_timer_service(tpool_ptr);
+    stop_poller(tpool_ptr);
+
+    // blocked submitters see the stopping flag and give up
+    drop_queued_jobs(tpool_ptr);
+    syscall(SYS_futex, &queue->not_full, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    // parked workers see the stopping flag right away
+    atomic_fetch_add(&queue->not_empty, 1);
+    syscall(SYS_futex, &queue->not_empty, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+
+    // workers exit after their current job, parked ones were woken above
+    // read under the lock: the last worker's unlock is its final access to the pool
+    while (true)
+    {
+        pthread_spin_lock(&tpool_ptr->count_lock);
+        size_t num_threads = tpool_ptr->num_threads;
+        pthread_spin_unlock(&tpool_ptr->count_lock);
+        if (num_threads == 0)
+            break;
+        usleep(10000);
+    }
+    // a strand that was running requeued itself after the queue was cleared
+    drop_queued_jobs(tpool_ptr);
+    // the poller is joined and no worker can register a fiber anymore
+    while (tpool_ptr->poller.awaiting != NULL)
+    {
+        job *fiber_job = tpool_ptr->poller.awaiting;
+        unlink_awaiting(&tpool_ptr->poller, fiber_job);
+        pthread_spin_lock(&tpool_ptr->count_lock);
+        tpool_ptr->num_suspended_fibers -= 1;
+        pthread_spin_unlock(&tpool_ptr->count_lock);
+        free_job(tpool_ptr, fiber_job);
+    }
+    pthread_mutex_destroy(&tpool_ptr->poller.lock);
+    // free datastructures
+    if (tpool_ptr->events != NULL)
+    {
+        // all workers are gone, the trace includes their last events
+        if (tpool_ptr->config.trace_path != NULL && !tpool_dump_trace(tpool_ptr, tpool_ptr->config.trace_path))
+        {
+            debug_print("could not write event trace to %s\n", tpool_ptr->config.trace_path);
+        }
+        event_recorder_destroy(tpool_ptr->events);
+    }
+    if (tpool_ptr->budget != NULL)
+    {
+        thread_budget_leave(tpool_ptr->budget);
+    }
+    if (tpool_ptr->pressure != NULL)
+    {
+        pressure_governor_destroy(tpool_ptr->pressure);
+    }
+    tpool_stop_recording_arrivals(tpool_ptr);
+    pthread_mutex_destroy(&tpool_ptr->arrivals.lock);
+    fiber_pool_destroy(&tpool_ptr->fibers);
+    free(tpool_ptr);
+}
+
+// NO ERROR HANDLING YET
+bool tpool_scale(tpool *tp, int diff)
+{
+    // don't go below one worker thread
+    if (tp->num_threads + diff <= 0)
+    {
+        debug_print("%s\n", "scaling down would drop below 1 worker, only scale down to 1 worker");
+        diff = 1 - tp->num_threads;
+    }
+    // don't go above max worker amount
+    else if (tp->num_threads + diff > MAX_SIZE)
+    {
+        debug_print("%s\n", "scaling up would go above max amount workers, only scale to max");
+        diff = MAX_SIZE - tp->num_threads;
+    }
+    // grab lock on jobqueue
+    debug_print("tpool (creator pid: %d) scaling to %d\n", tp->creator_pid, ((int) tp->num_threads) + diff);
+    int amount_jobs = diff < 0 ? -diff : diff;
+    pthread_spin_lock(&tp->jobqueue.lock);
+    if (diff < 0)
+    {
+        while (diff < 0)
+        {
+            push_scale_job(&tp->jobqueue, Terminate);
+            diff++;
+        }
+    }
+    else
+    {
+        while (diff > 0)
+        {
+            push_scale_job(&tp->jobqueue, Clone);
+            diff--;
+        }
+    }
+    // release lock
+    pthread_spin_unlock(&tp->jobqueue.lock);
+    notify_not_empty(&tp->jobqueue, amount_jobs);
+    return true;
+}
+
+/* =================== Internal ===================== */
+
+static job *create_user_job(tfunc ufunc, void *uarg)
+{
+    job *new_job = malloc(sizeof(job));
+    if (new_job == NULL)
+    {
+        return NULL;
+    }
+    new_job->next = NULL;
+    new_job->deadline_ms = 0;
+    new_job->ctl = NULL;
+    new_job->type = UserJob;
+    new_job->job_class = 0;
+    new_job->emplaced = false;
+    new_job->wi.uf.f = ufunc;
+    new_job->wi.uf.arg = uarg;
+    return new_job;
+}
+
+/*
+ * user job with len bytes of argument storage right behind the node's fields
+ * (one allocation, one free, no pointer chase to a separate argument block)
+ * sized exactly: aligned_alloc to whole cache lines bypasses malloc's per-thread caches and was slower
+ */
+static job *create_inline_job(tfunc ufunc, size_t len)
+{
+    job *new_job = malloc(offsetof(job, inline_arg) + len);
+    if (new_job == NULL)
+    {
+        return NULL;
+    }
+    new_job->next = NULL;
+    new_job->deadline_ms = 0;
+    new_job->ctl = NULL;
+    new_job->type = UserJob;
+    new_job->job_class = 0;
+    new_job->emplaced = false;
+    new_job->wi.uf.f = ufunc;
+    new_job->wi.uf.arg = new_job->inline_arg;
+    return new_job;
+}
+
+/*
+ * user job owning a copy of its argument
+ */
+static job *create_copy_job(tfunc ufunc, const void *arg_bytes, size_t len)
+{
+    job *new_job = create_inline_job(ufunc, len);
+    if (new_job != NULL && len > 0)
+    {
+        memcpy(new_job->inline_arg, arg_bytes, len);
+    }
+    return new_job;
+}
+
+/*
+ * queues a user job, takes ownership of new_job (freed if rejected)
+ */
+static bool submit_user_job(tpool *tpool_ptr, job *new_job)
+{
+    jobqueue *jobqueue_ptr = &(tpool_ptr->jobqueue);
+    if (jobqueue_ptr->capacity != 0)
+    {
+        return push_bounded(tpool_ptr, new_job);
+    }
+    // grab lock on jobqueue
+    pthread_spin_lock(&jobqueue_ptr->lock);
+    // push job to queue
+    push_new_job(jobqueue_ptr, new_job);
+    // release lock
+    pthread_spin_unlock(&jobqueue_ptr->lock);
+    notify_not_empty(jobqueue_ptr, 1);
+    return true;
+}
+
+static job *create_scale_job(scaling_command sc)
+{
+    job *new_job = malloc(sizeof(job));
+    if (new_job == NULL)
+    {
+        return NULL;
+    }
+    new_job->next = NULL;
+    new_job->deadline_ms = 0;
+    new_job->ctl = NULL;
+    new_job->type = ScaleJob;
+    new_job->job_class = 0;
+    new_job->emplaced = false;
+    new_job->wi.sc = sc;
+    return new_job;
+}
+
+static void init_jobqueue(jobqueue *jq, size_t capacity)
+{
+    if (jq == NULL)
+    {
+        return;
+    }
+    jq->first = NULL;
+    jq->last = NULL;
+    jq->size = 0;
+    jq->deferred = 0;
+    jq->capacity = capacity;
+    jq->high_water = 0;
+    jq->not_full = 0;
+    jq->waiting_submitters = 0;
+    atomic_init(&jq->not_empty, 0);
+    atomic_init(&jq->parked_workers, 0);
+}
+
+/*
+ * wakes one blocked submitter, call after releasing the jobqueue lock
+ */
+static void notify_not_full(jobqueue *jq)
+{
+    if (jq->waiting_submitters > 0)
+    {
+        syscall(SYS_futex, &jq->not_full, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/*
+ * pushes a user job onto a bounded queue, applying the overflow mode when full
+ * takes ownership of new_job
+ */
+static bool push_bounded(tpool *tpool_ptr, job *new_job)
+{
+    jobqueue *jq = &tpool_ptr->jobqueue;
+    pthread_spin_lock(&jq->lock);
+    while (jq->size >= jq->capacity)
+    {
+        if (tpool_ptr->stopping || tpool_ptr->config.overflow_mode == TPOOL_OVERFLOW_FAIL)
+        {
+            pthread_spin_unlock(&jq->lock);
+            free_job(tpool_ptr, new_job);
+            return false;
+        }
+        // fibers need a worker's scheduler context to switch back to, they wait for room instead
+        if (tpool_ptr->config.overflow_mode == TPOOL_OVERFLOW_RUN_INLINE && new_job->type != FiberJob)
+        {
+            pthread_spin_unlock(&jq->lock);
+            // an already expired job was still accepted, it is just dropped right away
+            if (!claim_job(tpool_ptr, new_job))
+            {
+                return true;
+            }
+            // a copied argument lives in the job, it is freed after running
+            new_job->wi.uf.f(new_job->wi.uf.arg);
+            free_job(tpool_ptr, new_job);
+            return true;
+        }
+        // sample the futex word under the lock, a pop after unlocking changes it
+        uint32_t seen = jq->not_full;
+        jq->waiting_submitters += 1;
+        pthread_spin_unlock(&jq->lock);
+        syscall(SYS_futex, &jq->not_full, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+        pthread_spin_lock(&jq->lock);
+        jq->waiting_submitters -= 1;
+    }
+    push_new_job(jq, new_job);
+    pthread_spin_unlock(&jq->lock);
+    notify_not_empty(jq, 1);
+    return true;
+}
+
+/*
+ * pops the head of the jobqueue
+ */
+static job *pop_next_job(jobqueue *jq)
+{
+    debug_print("%s", "pop\n");
+    job *head = jq->first;
+    if (head == NULL)
+    {
+        return NULL;
+    }
+    // update head (may be NULL if list empty now)
+    jq->first = head->next;
+    // update last if list empty now
+    if (jq->first == NULL)
+    {
+        jq->last = NULL;
+    }
+    // update size
     jq->size -= 1;
+    jq->not_full += 1;
     return head;
 }
 
 /*
- * pushes new job to the end of the jobqueue
+ * pops the oldest deferred job of a class that has room again, else the queue head,
+ * heads of classes at their limit move to the class's deferred list on the way
+ * every job is deferred at most once, so a pop is O(1) amortized (plus one look at each class)
+ * jobqueue must be locked by the caller
+ */
+static job *pop_runnable_job(tpool *tpool_ptr)
+{
+    jobqueue *jq = &tpool_ptr->jobqueue;
+    // deferred jobs are older than any queued job of their class, they go first
+    for (uint32_t job_class = 1; jq->deferred > 0 && job_class < TPOOL_MAX_CLASSES; job_class++)
+    {
+        job_class_state *state = &tpool_ptr->classes[job_class];
+        if (state->deferred_first != NULL && class_admits(tpool_ptr, job_class))
+        {
+            job *head = state->deferred_first;
+            state->deferred_first = head->next;
+            if (state->deferred_first == NULL)
+            {
+                state->deferred_last = NULL;
+            }
+            jq->deferred -= 1;
+            jq->size -= 1;
+            jq->not_full += 1;
+            return head;
+        }
+    }
+    // a class with deferred jobs is at its limit here, its queued jobs are deferred behind them
+    while (jq->first != NULL && !class_admits(tpool_ptr, jq->first->job_class))
+    {
+        job *head = jq->first;
+        jq->first = head->next;
+        if (jq->first == NULL)
+        {
+            jq->last = NULL;
+        }
+        defer_job(tpool_ptr, head);
+    }
+    return pop_next_job(jq);
+}
+
+/*
+ * appends a job to its class's deferred list, it stays counted in the queue size
+ * jobqueue must be locked by the caller
+ */
+static void defer_job(tpool *tpool_ptr, job *deferred)
+{
+    job_class_state *state = &tpool_ptr->classes[deferred->job_class];
+    deferred->next = NULL;
+    if (state->deferred_last == NULL)
+    {
+        state->deferred_first = deferred;
+    }
+    else
+    {
+        state->deferred_last->next = deferred;
+    }
+    state->deferred_last = deferred;
+    tpool_ptr->jobqueue.deferred += 1;
+}
+
+/*
+ * counts a job of the class as running if the class is below the limit, called with the jobqueue locked
+ * so admissions never race, finished jobs are released without the lock
+ * @return false if the job has to stay queued
+ */
+static bool class_admits(tpool *tpool_ptr, uint32_t job_class)
+{
+    // scale jobs, fibers and untagged jobs are all class 0
+    if (job_class == 0)
+    {
+        return true;
+    }
+    job_class_state *state = &tpool_ptr->classes[job_class];
+    size_t limit = atomic_load(&state->limit);
+    if (limit != 0 && atomic_load(&state->running) >= limit)
+    {
+        return false;
+    }
+    atomic_fetch_add(&state->running, 1);
+    return true;
+}
+
+static void release_class(tpool *tpool_ptr, uint32_t job_class)
+{
+    if (job_class == 0)
+    {
+        return;
+    }
+    job_class_state *state = &tpool_ptr->classes[job_class];
+    atomic_fetch_sub(&state->running, 1);
+    // a worker may have parked with only jobs of this class queued
+    if (atomic_load(&state->limit) != 0)
+    {
+        atomic_fetch_add(&tpool_ptr->jobqueue.not_empty, 1);
+        notify_not_empty(&tpool_ptr->jobqueue, 1);
+    }
+}
+
+/*
+ * pushes new job to the end of the jobqueue
+ */
+static void push_new_job(jobqueue *jq, job *new_job)
+{
+    //    debug_print("%s", "push\n");
+    new_job->next = NULL;
+    // if queue is empty new job becomes head and last (size also counts deferred jobs)
+    if (jq->first == NULL)
+    {
+        jq->first = new_job;
+    }
+    // otherwise the old last should point to the new job
+    else
+    {
+        job *old_last = jq->last;
+        old_last->next = new_job;
+    }
+    jq->last = new_job;
+    jq->size += 1;
+    atomic_fetch_add(&jq->not_empty, 1);
+    if (jq->size > jq->high_water)
+    {
+        jq->high_water = jq->size;
+    }
+}
+
+static void push_scale_job(jobqueue *jq, scaling_command sc)
+{
+    job *scj = create_scale_job(sc);
+    scj->next = jq->first;
+    jq->first = scj;
+    // on an empty queue the scale job is the tail as well, later pushes append to it
+    if (jq->last == NULL)
+    {
+        jq->last = scj;
+    }
+    jq->size += 1;
+    atomic_fetch_add(&jq->not_empty, 1);
+}
+
+static uint64_t monotonic_time_ms()
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t)spec.tv_sec * 1000 + (uint64_t)spec.tv_nsec / 1000000;
+}
+
+static uint64_t monotonic_time_ns()
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t)spec.tv_sec * 1000000000 + (uint64_t)spec.tv_nsec;
+}
+
+static unsigned long current_time_ms()
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_REALTIME, &spec);
+    unsigned long ms = (unsigned long)(spec.tv_nsec / 1.0e6) + (1000 * spec.tv_sec);
+    return ms;
+}
+
+/**
+ * check if pool needs to scale and add/remove worker accordingly
+ * @param worker_id
+ * @param tpool_ptr
+ * @return true if worker should exit
+ */
+static void check_scaling(tpool *tpool_ptr, size_t wid)
+{
+    debug_print("worker %zu get scaling advice\n", wid);
+    int advice = get_scaling_advice();
+    int to_scale = advice;
+    uint64_t jobs_completed = atomic_load_explicit(&tpool_ptr->jobs_completed, memory_order_relaxed);
+    // local limits first, the shared budget then only hands out threads the pool can use
+    if (tpool_ptr->pressure != NULL)
+    {
+        to_scale = pressure_governor_apply(tpool_ptr->pressure, tpool_ptr->num_threads, jobs_completed, to_scale);
+    }
+    if (tpool_ptr->budget != NULL)
+    {
+        to_scale = thread_budget_apply(tpool_ptr->budget, tpool_ptr->num_threads, jobs_completed, to_scale);
+    }
+    // asked on every loop iteration, only advice that would change something is worth the ring space
+    if (advice != 0 || to_scale != 0)
+    {
+        record_event(tpool_ptr, EventScalingAdvice, (uint64_t)(int64_t)advice, to_scale);
+    }
+    debug_print("worker %zu got scaling advice: scale by %d\n", wid, to_scale);
+    if (to_scale != 0)
+    {
+        debug_print("worker %zu SCALING now: %lu (by %d)\n", wid, current_time_ms(), to_scale);
+        tpool_scale(tpool_ptr, to_scale);
+    }
+    else
+    {
+        debug_print("worker %zu no scaling\n", wid);
+    }
+}
+
+static void worker_function(worker_args *args)
+{
+    char thread_name[20];
+    sprintf(thread_name, "worker-%zu", args->wid);
+    tpool *tpool_ptr = args->tp;
+    pid_t worker_pid = syscall(__NR_gettid);
+    debug_print("worker %zu starting (pid: %d)\n", args->wid, worker_pid);
+    pthread_setname_np(pthread_self(), thread_name);
+    if (!tpool_ptr->is_static)
+    {
+        add_tracee(worker_pid);
+        debug_print("worker %zu added as tracee (pid: %d)\n", args->wid, worker_pid);
+    }
+    jobqueue *jobqueue_ptr = &(tpool_ptr->jobqueue);
+    job *job_todo;
+    uint64_t last_sample_ms = 0;
+    // start in the middle, the first idle periods move it towards the pool's arrival pattern
+    uint32_t spin_hit_rate = SPIN_RATE_ONE / 2;
+    worker_state state;
+    init_worker_state(tpool_ptr, &state, args->wid);
+    while (!tpool_ptr->stopping)
+    {
+        if (!tpool_ptr->is_static)
+            check_scaling(tpool_ptr, args->wid);
+        report_metrics(tpool_ptr, &state, args->wid, &last_sample_ms, false);
+        if (jobqueue_ptr->size == 0 && spin_for_job(tpool_ptr, &spin_hit_rate))
+        {
+            continue;
+        }
+        while (jobqueue_ptr->size == 0)
+        {
+            record_event(tpool_ptr, EventPark, 0, 0);
+            park_for_job(tpool_ptr);
+            record_event(tpool_ptr, EventWake, 0, 0);
+            if (!tpool_ptr->is_static)
+                check_scaling(tpool_ptr, args->wid);
+            report_metrics(tpool_ptr, &state, args->wid, &last_sample_ms, false);
+            if (tpool_ptr->stopping)
+                break;
+        }
+        // sampled before the queue is scanned, a class slot freed after the scan changes it
+        uint32_t seen = atomic_load(&jobqueue_ptr->not_empty);
+        /* LOCK jobqueue */
+        pthread_spin_lock(&jobqueue_ptr->lock);
+        // if thread pool is instructed to be destroyed, do not process next job, but exit
+        if (tpool_ptr->stopping)
+        {
+            pthread_spin_unlock(&jobqueue_ptr->lock);
+            break;
+        }
+        // get next job
+        debug_print("queue size: %zu\n", jobqueue_ptr->size);
+        debug_print("worker %zu popping job\n", args->wid);
+        job_todo = pop_runnable_job(tpool_ptr);
+        size_t queue_depth = jobqueue_ptr->size;
+        pthread_spin_unlock(&jobqueue_ptr->lock);
+        /* UNLOCKED jobqueue */
+        if (job_todo != NULL)
+        {
+            notify_not_full(jobqueue_ptr);
+            record_event(tpool_ptr, EventPop, 0, queue_depth);
+        }
+        else if (queue_depth != 0)
+        {
+            // only jobs of classes at their limit are queued
+            record_event(tpool_ptr, EventPark, 0, 0);
+            park_until_admitted(tpool_ptr, seen);
+            record_event(tpool_ptr, EventWake, 0, 0);
+            continue;
+        }
+        uint32_t job_class = job_todo != NULL ? job_todo->job_class : 0;
+
+        // cancelled or expired jobs are discarded here, they do not count as busy
+        if (job_todo != NULL && job_todo->type == UserJob && !claim_job(tpool_ptr, job_todo))
+        {
+            release_class(tpool_ptr, job_class);
+            continue;
+        }
+        // check if really obtained job (queue could have been empty)
+        if (job_todo != NULL && job_todo->type == UserJob)
+        {
+            // --- busy counter LOCKED
+            pthread_spin_lock(&tpool_ptr->count_lock);
+            tpool_ptr->num_busy_threads += 1;
+            pthread_spin_unlock(&tpool_ptr->count_lock);
+            // --- busy counter UNLOCKED
+            debug_print("worker %zu executing job\n", args->wid);
+            // execute job
+            record_event(tpool_ptr, EventStart, (uint64_t)job_todo->wi.uf.f, 0);
+            uint64_t start_ns = 0;
+            tpool_worker_metrics io_before;
+            bool io_valid = false;
+            if (tpool_ptr->config.class_accounting)
+            {
+                start_ns = monotonic_time_ns();
+                io_valid = state.io_fd >= 0 && thread_io_read(state.io_fd, &io_before);
+            }
+            job_todo->wi.uf.f(job_todo->wi.uf.arg);
+            if (tpool_ptr->config.class_accounting)
+            {
+                account_job(&state, job_class, start_ns, io_valid ? &io_before : NULL);
+            }
+            release_class(tpool_ptr, job_class);
+            record_event(tpool_ptr, EventEnd, 0, 0);
+            reset_arena(&state);
+            if (tpool_ptr->budget != NULL || tpool_ptr->pressure != NULL)
+                atomic_fetch_add_explicit(&tpool_ptr->jobs_completed, 1, memory_order_relaxed);
+            // free
+            free_job(tpool_ptr, job_todo);
+            // decrease number of threads executing a job
+            // --- busy counter LOCKED
+            pthread_spin_lock(&tpool_ptr->count_lock);
+            tpool_ptr->num_busy_threads -= 1;
+            pthread_spin_unlock(&tpool_ptr->count_lock);
+            // --- busy counter UNLOCKED
+        }
+        else if (job_todo != NULL && job_todo->type == FiberJob)
+        {
+            pthread_spin_lock(&tpool_ptr->count_lock);
+            tpool_ptr->num_busy_threads += 1;
+            pthread_spin_unlock(&tpool_ptr->count_lock);
+            debug_print("worker %zu running fiber\n", args->wid);
+            // takes ownership of the job, it is requeued if the fiber suspends
+            record_event(tpool_ptr, EventStart, (uint64_t)job_todo->wi.fb->f, 0);
+            run_fiber(tpool_ptr, job_todo);
+            record_event(tpool_ptr, EventEnd, 0, 0);
+            pthread_spin_lock(&tpool_ptr->count_lock);
+            tpool_ptr->num_busy_threads -= 1;
+            pthread_spin_unlock(&tpool_ptr->count_lock);
+        }
+        else if (job_todo != NULL)
+        {
+            if (job_todo->wi.sc == Clone)
+            {
+                debug_print("worker %zu performing clone\n", args->wid);
+                pthread_spin_lock(&tpool_ptr->workers.lock);
+                add_extra_worker(tpool_ptr);
+                pthread_spin_unlock(&tpool_ptr->workers.lock);
+                record_event(tpool_ptr, EventClone, 0, tpool_ptr->num_threads);
+            }
+            else if (job_todo->wi.sc == Terminate)
+            {
+                debug_print("worker %zu performing terminate\n", args->wid);
+                record_event(tpool_ptr, EventTerminate, 0, tpool_ptr->num_threads - 1);
+                free(job_todo);
+                break;
+            }
+            free(job_todo);
+        }
+    }
+    if (tpool_ptr->config.worker_exit != NULL)
+    {
+        tpool_ptr->config.worker_exit(state.local, args->wid, tpool_ptr->config.worker_ctx);
+    }
+    reset_arena(&state);
+    free(state.arena);
+    if (state.io_fd >= 0)
+    {
+        close(state.io_fd);
+    }
+    current_worker = NULL;
+    // workers created and terminated by scaling are accounted as well
+    report_metrics(tpool_ptr, &state, args->wid, &last_sample_ms, true);
+    // remove from workers list
+    pthread_spin_lock(&tpool_ptr->workers.lock);
+    remove_worker(args->wid, tpool_ptr);
+    pthread_spin_unlock(&tpool_ptr->workers.lock);
+    bool is_static = tpool_ptr->is_static;
+    free(args);
+    // update active thread amount, last access: tpool_destroy reads the count under the same lock
+    // and frees the pool only once this unlock happened
+    pthread_spin_lock(&tpool_ptr->count_lock);
+    tpool_ptr->num_threads--;
+    pthread_spin_unlock(&tpool_ptr->count_lock);
+    if (!is_static)
+        remove_tracee(worker_pid);
+}
+
+/**
+ * worker list must be locked/unlocked by caller
+ * @param worker_id
+ * @param tpool_ptr
+ */
+static void remove_worker(size_t worker_id, tpool *tpool_ptr)
+{
+    worker *current = tpool_ptr->workers.first;
+    worker *last = NULL;
+    while (current != NULL)
+    {
+        if (current->wid == worker_id)
+        {
+            // if first
+            if (last == NULL)
+            {
+                tpool_ptr->workers.first = current->next;
+            }
+            else
+            {
+                last->next = current->next;
+            }
+            // if last
+            if (current->next == NULL)
+            {
+                tpool_ptr->workers.last = last;
+            }
+            free(current);
+            tpool_ptr->workers.amount -= 1;
+            break;
+        }
+        last = current;
+        current = current->next;
+    }
+}
+
+/**
+ * worker list must be locked/unlocked by caller
+ * @param tpool_ptr
+ */
+static void add_extra_worker(tpool *tpool_ptr)
+{
+    pthread_t thread;
+    worker *new_worker = malloc(sizeof(worker));
+    new_worker->wid = tpool_ptr->workers.max_id + 1;
+    new_worker->next = NULL;
+
+    debug_print("creating worker %zu\n", new_worker->wid);
+    worker_args *worker_args_ptr = malloc(sizeof(worker_args));
+    worker_args_ptr->tp = tpool_ptr;
+    worker_args_ptr->wid = new_worker->wid;
+
+    debug_print("creating worker %zu's pthread\n", new_worker->wid);
+    pthread_create(&thread, NULL, (void *(*)(void *))worker_function, (void *)worker_args_ptr);
+    pthread_detach(thread);
+    new_worker->thread = thread;
+
+    pthread_spin_lock(&tpool_ptr->count_lock);
+    tpool_ptr->num_threads += 1;
+    pthread_spin_unlock(&tpool_ptr->count_lock);
+
+    // append worker to worker list
+    tpool_ptr->workers.last->next = new_worker;
+    tpool_ptr->workers.last = new_worker;
+    tpool_ptr->workers.amount += 1;
+    tpool_ptr->workers.max_id = new_worker->wid;
+}
+
+static bool init_timer_service(timer_service *ts)
+{
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    // deadlines are computed on the monotonic clock
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    ts->running = false;
+    if (pthread_mutex_init(&ts->lock, NULL) != 0)
+    {
+        pthread_condattr_destroy(&cond_attr);
+        return false;
+    }
+    bool ok = pthread_cond_init(&ts->cond, &cond_attr) == 0;
+    pthread_condattr_destroy(&cond_attr);
+    if (!ok)
+    {
+        pthread_mutex_destroy(&ts->lock);
+        return false;
+    }
+    if (!tw_init(&ts->wheel, monotonic_time_ms()))
+    {
+        // a failed grow leaves the wheel without nodes, nothing to free
+        pthread_cond_destroy(&ts->cond);
+        pthread_mutex_destroy(&ts->lock);
+        return false;
+    }
+    return true;
+}
+
+static tpool_timer add_timer(tpool *tpool_ptr, uint64_t delay_ms, uint64_t period_ms, tfunc f, void *arg)
+{
+    timer_service *ts = &tpool_ptr->timers;
+    pthread_mutex_lock(&ts->lock);
+    if (tpool_ptr->stopping)
+    {
+        pthread_mutex_unlock(&ts->lock);
+        return 0;
+    }
+    if (!ts->running)
+    {
+        debug_print("%s", "starting timer thread\n");
+        if (pthread_create(&ts->thread, NULL, (void *(*)(void *))timer_function, (void *)tpool_ptr) != 0)
+        {
+            pthread_mutex_unlock(&ts->lock);
+            return 0;
+        }
+        ts->running = true;
+    }
+    tpool_timer timer = tw_insert(&ts->wheel, monotonic_time_ms(), delay_ms, period_ms, f, arg);
+    // timer thread may be sleeping past the new deadline
+    pthread_cond_signal(&ts->cond);
+    pthread_mutex_unlock(&ts->lock);
+    return timer;
+}
+
+/*
+ * stopping flag must already be set
  */
-static void push_new_job(jobqueue *jq, job *new_job)
+static void stop_timer_service(tpool *tpool_ptr)
 {
-    //    debug_print("%s", "push\n");
+    timer_service *ts = &tpool_ptr->timers;
+    pthread_mutex_lock(&ts->lock);
+    bool running = ts->running;
+    ts->running = false;
+    pthread_cond_signal(&ts->cond);
+    pthread_mutex_unlock(&ts->lock);
+    if (running)
+    {
+        pthread_join(ts->thread, NULL);
+    }
+    tw_free(&ts->wheel);
+    pthread_cond_destroy(&ts->cond);
+    pthread_mutex_destroy(&ts->lock);
+}
+
+/*
+ * sleeps until the next occupied tick, then hands all due jobs to the jobqueue
+ */
+static void timer_function(tpool *tpool_ptr)
+{
+    timer_service *ts = &tpool_ptr->timers;
+    pthread_setname_np(pthread_self(), "tpool-timer");
+    pthread_mutex_lock(&ts->lock);
+    while (!tpool_ptr->stopping)
+    {
+        tw_advance(&ts->wheel, monotonic_time_ms(), enqueue_due_job, tpool_ptr);
+        if (ts->wheel.active == 0)
+        {
+            pthread_cond_wait(&ts->cond, &ts->lock);
+            continue;
+        }
+        uint64_t deadline_ms = tw_next_deadline(&ts->wheel);
+        struct timespec deadline = {
+            .tv_sec = deadline_ms / 1000,
+            .tv_nsec = (deadline_ms % 1000) * 1000000};
+        pthread_cond_timedwait(&ts->cond, &ts->lock, &deadline);
+    }
+    pthread_mutex_unlock(&ts->lock);
+}
+
+/*
+ * called by the timing wheel with the timer lock held,
+ * due jobs bypass the queue capacity, the timer thread must never block
+ */
+static void enqueue_due_job(tfunc f, void *arg, void *ctx)
+{
+    tpool *tpool_ptr = ctx;
+    job *new_job_ptr = create_user_job(f, arg);
+    if (new_job_ptr == NULL)
+    {
+        debug_print("%s", "dropping due job, out of memory\n");
+        return;
+    }
+    pthread_spin_lock(&tpool_ptr->jobqueue.lock);
+    push_new_job(&tpool_ptr->jobqueue, new_job_ptr);
+    pthread_spin_unlock(&tpool_ptr->jobqueue.lock);
+    notify_not_empty(&tpool_ptr->jobqueue, 1);
+}
+
+static job *create_fiber_job(tpool *tpool_ptr, tfunc ufunc, void *uarg)
+{
+    job *new_job = malloc(sizeof(job));
+    if (new_job == NULL)
+    {
+        return NULL;
+    }
+    fiber *fb = fiber_acquire(&tpool_ptr->fibers, fiber_entry, ufunc, uarg);
+    if (fb == NULL)
+    {
+        free(new_job);
+        return NULL;
+    }
     new_job->next = NULL;
-    // if queue is empty new job becomes head and last
-    if (jq->size == 0)
+    new_job->deadline_ms = 0;
+    new_job->ctl = NULL;
+    new_job->type = FiberJob;
+    new_job->job_class = 0;
+    new_job->emplaced = false;
+    new_job->wi.fb = fb;
+    return new_job;
+}
+
+/*
+ * switches into the fiber until it suspends or finishes,
+ * then requeues, parks or releases it depending on why it switched back
+ */
+static void run_fiber(tpool *tpool_ptr, job *fiber_job)
+{
+    fiber *fb = fiber_job->wi.fb;
+    fb->caller = &scheduler_ctx;
+    fb->state = FiberRunnable;
+    running_fiber = fb;
+    swapcontext(&scheduler_ctx, &fb->ctx);
+    running_fiber = NULL;
+    switch (fb->state)
+    {
+    case FiberYielded:
+        push_internal_job(tpool_ptr, fiber_job);
+        break;
+    case FiberAwaiting:
+        await_in_poller(tpool_ptr, fiber_job);
+        break;
+    default:
+        fiber_release(&tpool_ptr->fibers, fb);
+        free(fiber_job);
+        break;
+    }
+}
+
+/*
+ * first function on every fiber stack
+ */
+static void fiber_entry(void)
+{
+    fiber *fb = running_fiber;
+    fb->f(fb->arg);
+    fb->state = FiberFinished;
+    // caller is updated on every resume, this is the worker that ran the last slice
+    setcontext(fb->caller);
+}
+
+/*
+ * pushes a job that was already accepted once (resumed fiber), bypasses the capacity
+ */
+static void push_internal_job(tpool *tpool_ptr, job *internal_job)
+{
+    pthread_spin_lock(&tpool_ptr->jobqueue.lock);
+    push_new_job(&tpool_ptr->jobqueue, internal_job);
+    pthread_spin_unlock(&tpool_ptr->jobqueue.lock);
+    notify_not_empty(&tpool_ptr->jobqueue, 1);
+}
+
+/*
+ * registers the fiber's fd with the poller, fds epoll can not watch
+ * (e.g. regular files) are always ready so the fiber is requeued right away
+ */
+static void await_in_poller(tpool *tpool_ptr, job *fiber_job)
+{
+    fiber *fb = fiber_job->wi.fb;
+    fiber_poller *fp = &tpool_ptr->poller;
+    // held until registered: stop_poller closes the fds only once it took the lock after this
+    pthread_mutex_lock(&fp->lock);
+    if (!start_poller(tpool_ptr))
+    {
+        pthread_mutex_unlock(&fp->lock);
+        push_internal_job(tpool_ptr, fiber_job);
+        return;
+    }
+    // linked before epoll_ctl, the poller unlinks it under the lock as soon as the fd is ready
+    fb->await_prev = NULL;
+    fb->await_next = fp->awaiting;
+    if (fp->awaiting != NULL)
+    {
+        fp->awaiting->wi.fb->await_prev = fiber_job;
+    }
+    fp->awaiting = fiber_job;
+    pthread_spin_lock(&tpool_ptr->count_lock);
+    tpool_ptr->num_suspended_fibers += 1;
+    pthread_spin_unlock(&tpool_ptr->count_lock);
+
+    struct epoll_event event;
+    event.events = fb->await_events | EPOLLONESHOT;
+    event.data.ptr = fiber_job;
+    if (epoll_ctl(fp->epoll_fd, EPOLL_CTL_ADD, fb->await_fd, &event) != 0 &&
+        epoll_ctl(fp->epoll_fd, EPOLL_CTL_MOD, fb->await_fd, &event) != 0)
+    {
+        debug_print("fd %d can not be polled, resuming fiber\n", fb->await_fd);
+        unlink_awaiting(fp, fiber_job);
+        pthread_spin_lock(&tpool_ptr->count_lock);
+        tpool_ptr->num_suspended_fibers -= 1;
+        pthread_spin_unlock(&tpool_ptr->count_lock);
+        pthread_mutex_unlock(&fp->lock);
+        push_internal_job(tpool_ptr, fiber_job);
+        return;
+    }
+    pthread_mutex_unlock(&fp->lock);
+}
+
+/*
+ * starts the poller thread on first use, poller lock must be held by the caller
+ */
+static bool start_poller(tpool *tpool_ptr)
+{
+    fiber_poller *fp = &tpool_ptr->poller;
+    if (!fp->running && !tpool_ptr->stopping)
+    {
+        debug_print("%s", "starting fiber poller\n");
+        fp->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        fp->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        if (fp->epoll_fd >= 0 && fp->wake_fd >= 0 &&
+            epoll_ctl(fp->epoll_fd, EPOLL_CTL_ADD, fp->wake_fd, &event) == 0 &&
+            pthread_create(&fp->thread, NULL, (void *(*)(void *))poller_function, (void *)tpool_ptr) == 0)
+        {
+            fp->running = true;
+        }
+        else
+        {
+            close(fp->epoll_fd);
+            close(fp->wake_fd);
+        }
+    }
+    return fp->running;
+}
+
+/*
+ * removes a fiber job from the awaiting list, poller lock must be held (or the poller be gone)
+ */
+static void unlink_awaiting(fiber_poller *fp, job *fiber_job)
+{
+    fiber *fb = fiber_job->wi.fb;
+    if (fb->await_prev != NULL)
+        fb->await_prev->wi.fb->await_next = fb->await_next;
+    else
+        fp->awaiting = fb->await_next;
+    if (fb->await_next != NULL)
+        fb->await_next->wi.fb->await_prev = fb->await_prev;
+    fb->await_prev = NULL;
+    fb->await_next = NULL;
+}
+
+static void stop_poller(tpool *tpool_ptr)
+{
+    fiber_poller *fp = &tpool_ptr->poller;
+    pthread_mutex_lock(&fp->lock);
+    bool running = fp->running;
+    fp->running = false;
+    pthread_mutex_unlock(&fp->lock);
+    if (running)
+    {
+        uint64_t one = 1;
+        write(fp->wake_fd, &one, sizeof(one));
+        pthread_join(fp->thread, NULL);
+        close(fp->epoll_fd);
+        close(fp->wake_fd);
+    }
+}
+
+/*
+ * hands fibers whose fd became ready back to the jobqueue
+ */
+static void poller_function(tpool *tpool_ptr)
+{
+    fiber_poller *fp = &tpool_ptr->poller;
+    struct epoll_event events[64];
+    pthread_setname_np(pthread_self(), "tpool-poller");
+    while (!tpool_ptr->stopping)
+    {
+        int ready = epoll_wait(fp->epoll_fd, events, 64, -1);
+        for (int i = 0; i < ready; i++)
+        {
+            job *fiber_job = events[i].data.ptr;
+            // wake fd, only used for shutdown
+            if (fiber_job == NULL)
+            {
+                continue;
+            }
+            pthread_mutex_lock(&fp->lock);
+            unlink_awaiting(fp, fiber_job);
+            pthread_mutex_unlock(&fp->lock);
+            pthread_spin_lock(&tpool_ptr->count_lock);
+            tpool_ptr->num_suspended_fibers -= 1;
+            pthread_spin_unlock(&tpool_ptr->count_lock);
+            push_internal_job(tpool_ptr, fiber_job);
+        }
+    }
+}
+
+/*
+ * frees a finished job or one that will never run, including a not yet finished fiber
+ */
+static void free_job(tpool *tpool_ptr, job *to_free)
+{
+    if (to_free->emplaced)
+    {
+        emplace_header *header = (emplace_header *)to_free->inline_arg;
+        if (header->dispose != NULL)
+            header->dispose(header->arg);
+    }
+    if (to_free->type == FiberJob)
+    {
+        fiber_release(&tpool_ptr->fibers, to_free->wi.fb);
+    }
+    if (to_free->ctl != NULL)
+    {
+        release_job_ctl(to_free->ctl);
+    }
+    free(to_free);
+}
+
+/*
+ * frees all queued jobs without running them, a queued strand run takes the strand's jobs with it
+ */
+static void drop_queued_jobs(tpool *tpool_ptr)
+{
+    jobqueue *queue = &tpool_ptr->jobqueue;
+    pthread_spin_lock(&queue->lock);
+    // the deferred lists of the classes are dropped along with the queue
+    for (uint32_t job_class = 1; job_class < TPOOL_MAX_CLASSES; job_class++)
+    {
+        job_class_state *state = &tpool_ptr->classes[job_class];
+        if (state->deferred_first != NULL)
+        {
+            state->deferred_last->next = queue->first;
+            queue->first = state->deferred_first;
+            state->deferred_first = NULL;
+            state->deferred_last = NULL;
+        }
+    }
+    job *to_free = queue->first;
+    while (to_free != NULL)
+    {
+        job *new_to_free = to_free->next;
+        if (to_free->type == UserJob && to_free->wi.uf.f == run_strand)
+        {
+            drop_strand(to_free->wi.uf.arg);
+        }
+        free_job(tpool_ptr, to_free);
+        to_free = new_to_free;
+    }
+    queue->first = NULL;
+    queue->last = NULL;
+    queue->size = 0;
+    queue->deferred = 0;
+    queue->not_full += 1;
+    pthread_spin_unlock(&queue->lock);
+}
+
+/*
+ * frees a strand and its jobs, only called once no worker runs it and the pool is stopping
+ * (a strand with queued jobs always has its run queued)
+ */
+static void drop_strand(tpool_strand_t *strand)
+{
+    strand_node *node = strand_pop(strand);
+    while (node != NULL)
+    {
+        free(node);
+        node = strand_pop(strand);
+    }
+    free(strand);
+}
+
+/*
+ * decides at dequeue whether a user job runs, frees it (after the drop callback) if not
+ * @return true if the caller should execute the job
+ */
+static bool claim_job(tpool *tpool_ptr, job *user_job)
+{
+    if (user_job->ctl == NULL && user_job->deadline_ms == 0)
+    {
+        return true;
+    }
+    // the clock is only read for jobs that have a deadline
+    bool expired = user_job->deadline_ms != 0 && monotonic_time_ms() > user_job->deadline_ms;
+    tpool_drop_reason reason = TPOOL_DROP_EXPIRED;
+    if (user_job->ctl != NULL)
+    {
+        int expected = JobQueued;
+        if (atomic_compare_exchange_strong(&user_job->ctl->state, &expected, expired ? JobDropped : JobRunning))
+        {
+            if (!expired)
+            {
+                return true;
+            }
+        }
+        else
+        {
+            reason = TPOOL_DROP_CANCELLED;
+        }
+    }
+    else if (!expired)
     {
-        jq->first = new_job;
+        return true;
     }
-    // otherwise the old last should point to the new job
-    else
+    atomic_fetch_add(reason == TPOOL_DROP_CANCELLED ? &tpool_ptr->jobs_cancelled : &tpool_ptr->jobs_expired, 1);
+    if (tpool_ptr->config.drop_callback != NULL)
     {
-        job *old_last = jq->last;
-        old_last->next = new_job;
+        tpool_ptr->config.drop_callback(user_job->wi.uf.f, user_job->wi.uf.arg, reason, tpool_ptr->config.drop_ctx);
     }
-    jq->last = new_job;
-    jq->size += 1;
+    free_job(tpool_ptr, user_job);
+    return false;
 }
 
-static void push_scale_job(jobqueue *jq, scaling_command sc)
+static void release_job_ctl(tpool_job_ctl *ctl)
 {
-    job *scj = create_scale_job(sc);
-    scj->next = jq->first;
-    jq->first = scj;
-    jq->size += 1;
+    if (atomic_fetch_sub(&ctl->refs, 1) == 1)
+    {
+        free(ctl);
+    }
 }
 
-static unsigned long current_time_ms()
+static void strand_push(tpool_strand_t *strand, strand_node *node)
 {
-    struct timespec spec;
-    clock_gettime(CLOCK_REALTIME, &spec);
-    unsigned long ms = (unsigned long)(spec.tv_nsec / 1.0e6) + (1000 * spec.tv_sec);
-    return ms;
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    strand_node *prev = atomic_exchange_explicit(&strand->tail, node, memory_order_acq_rel);
+    // between exchange and this store the consumer sees a gap, strand_pop returns NULL then
+    atomic_store_explicit(&prev->next, node, memory_order_release);
 }
 
-/**
- * check if pool needs to scale and add/remove worker accordingly
- * @param worker_id
- * @param tpool_ptr
- * @return true if worker should exit
+/*
+ * consumer side, only called by the worker running the strand
+ * @return NULL if the queue is empty or a producer is mid-push
  */
-static void check_scaling(tpool *tpool_ptr, size_t wid)
+static strand_node *strand_pop(tpool_strand_t *strand)
 {
-    debug_print("worker %zu get scaling advice\n", wid);
-    int to_scale = get_scaling_advice();
-    debug_print("worker %zu got scaling advice: scale by %d\n", wid, to_scale);
-    if (to_scale != 0)
+    strand_node *head = strand->head;
+    strand_node *next = atomic_load_explicit(&head->next, memory_order_acquire);
+    if (head == &strand->stub)
     {
-        debug_print("worker %zu SCALING now: %lu (by %d)\n", wid, current_time_ms(), to_scale);
-        tpool_scale(tpool_ptr, to_scale);
+        if (next == NULL)
+        {
+            return NULL;
+        }
+        strand->head = next;
+        head = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
     }
-    else
+    if (next != NULL)
     {
-        debug_print("worker %zu no scaling\n", wid);
+        strand->head = next;
+        return head;
     }
+    if (head != atomic_load_explicit(&strand->tail, memory_order_acquire))
+    {
+        return NULL;
+    }
+    // head is the last node, put the stub behind it so head can be handed out
+    strand_push(strand, &strand->stub);
+    next = atomic_load_explicit(&head->next, memory_order_acquire);
+    if (next != NULL)
+    {
+        strand->head = next;
+        return head;
+    }
+    return NULL;
 }
 
-static void worker_function(worker_args *args)
+static bool strand_enqueue(tpool_strand_t *strand, tfunc f, void *arg)
 {
-    char thread_name[20];
-    sprintf(thread_name, "worker-%zu", args->wid);
-    tpool *tpool_ptr = args->tp;
-    pid_t worker_pid = syscall(__NR_gettid);
-    debug_print("worker %zu starting (pid: %d)\n", args->wid, worker_pid);
-    pthread_setname_np(pthread_self(), thread_name);
-    if (!tpool_ptr->is_static)
+    strand_node *node = malloc(sizeof(strand_node));
+    if (node == NULL)
     {
-        add_tracee(worker_pid);
-        debug_print("worker %zu added as tracee (pid: %d)\n", args->wid, worker_pid);
+        return false;
     }
-    jobqueue *jobqueue_ptr = &(tpool_ptr->jobqueue);
-    job *job_todo;
-    while (!tpool_ptr->stopping)
+    node->f = f;
+    node->arg = arg;
+    strand_push(strand, node);
+    if (atomic_fetch_add_explicit(&strand->pending, 1, memory_order_acq_rel) == 0)
     {
-        if (!tpool_ptr->is_static)
-            check_scaling(tpool_ptr, args->wid);
-        while (jobqueue_ptr->size == 0)
+        schedule_strand(strand);
+    }
+    return true;
+}
+
+/*
+ * queues a run of the strand, bypasses the capacity: its jobs were already accepted
+ */
+static void schedule_strand(tpool_strand_t *strand)
+{
+    job *run_job = create_user_job(run_strand, strand);
+    while (run_job == NULL)
+    {
+        // the strand would never run again otherwise
+        sched_yield();
+        run_job = create_user_job(run_strand, strand);
+    }
+    push_internal_job(strand->tp, run_job);
+}
+
+/*
+ * executes the strand's jobs in submission order, only ever one instance per strand
+ */
+static void run_strand(void *arg)
+{
+    tpool_strand_t *strand = arg;
+    for (int executed = 0; executed < STRAND_BATCH; executed++)
+    {
+        strand_node *node = strand_pop(strand);
+        // pending says there is a job, a producer is just linking it
+        while (node == NULL)
         {
-            sleep(1);
-            if (!tpool_ptr->is_static)
-                check_scaling(tpool_ptr, args->wid);
-            if (tpool_ptr->stopping)
-                break;
+            sched_yield();
+            node = strand_pop(strand);
         }
-        /* LOCK jobqueue */
-        pthread_spin_lock(&jobqueue_ptr->lock);
-        // if thread pool is instructed to be destroyed, do not process next job, but exit
-        if (tpool_ptr->stopping)
+        if (node->f == NULL)
         {
-            jobqueue_ptr->lock = -1;
-            break;
+            // destroy request, nothing can be queued behind it
+            free(node);
+            free(strand);
+            return;
         }
-        // get next job
-        debug_print("queue size: %zu\n", jobqueue_ptr->size);
-        debug_print("worker %zu popping job\n", args->wid);
-        job_todo = pop_next_job(jobqueue_ptr);
-        pthread_spin_unlock(&jobqueue_ptr->lock);
-        /* UNLOCKED jobqueue */
+        node->f(node->arg);
+        free(node);
+        if (atomic_fetch_sub_explicit(&strand->pending, 1, memory_order_acq_rel) == 1)
+        {
+            return;
+        }
+    }
+    schedule_strand(strand);
+}
 
-        // check if really obtained job (queue could have been empty)
-        if (job_todo != NULL && job_todo->is_uf)
+/*
+ * logs a submit while recording, the class is the index of the job function
+ */
+static void record_arrival(tpool *tpool_ptr, tfunc f)
+{
+    arrival_recorder *recorder = &tpool_ptr->arrivals;
+    if (atomic_load_explicit(&recorder->writer, memory_order_acquire) == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&recorder->lock);
+    arrival_writer *writer = atomic_load_explicit(&recorder->writer, memory_order_relaxed);
+    if (writer != NULL)
+    {
+        size_t job_class = 0;
+        while (job_class < recorder->num_classes && recorder->classes[job_class] != f)
         {
-            // --- busy counter LOCKED
-            pthread_spin_lock(&tpool_ptr->count_lock);
-            tpool_ptr->num_busy_threads += 1;
-            pthread_spin_unlock(&tpool_ptr->count_lock);
-            // --- busy counter UNLOCKED
-            debug_print("worker %zu executing job\n", args->wid);
-            // execute job
-            job_todo->wi.uf.f(job_todo->wi.uf.arg);
-            // free
-            free(job_todo);
-            // decrease number of threads executing a job
-            // --- busy counter LOCKED
-            pthread_spin_lock(&tpool_ptr->count_lock);
-            tpool_ptr->num_busy_threads -= 1;
-            pthread_spin_unlock(&tpool_ptr->count_lock);
-            // --- busy counter UNLOCKED
+            job_class++;
         }
-        else if (job_todo != NULL)
+        if (job_class == recorder->num_classes && job_class < MAX_ARRIVAL_CLASSES)
         {
-            if (job_todo->wi.sc == Clone)
-            {
-                debug_print("worker %zu performing clone\n", args->wid);
-                pthread_spin_lock(&tpool_ptr->workers.lock);
-                add_extra_worker(tpool_ptr);
-                pthread_spin_unlock(&tpool_ptr->workers.lock);
-            }
-            else if (job_todo->wi.sc == Terminate)
-            {
-                debug_print("worker %zu performing terminate\n", args->wid);
-                break;
-            }
+            recorder->classes[job_class] = f;
+            recorder->num_classes++;
         }
+        else if (job_class == MAX_ARRIVAL_CLASSES)
+        {
+            job_class = MAX_ARRIVAL_CLASSES - 1;
+        }
+        arrival_writer_record(writer, (uint32_t)job_class);
     }
-    // remove from workers list
-    pthread_spin_lock(&tpool_ptr->workers.lock);
-    remove_worker(args->wid, tpool_ptr);
-    pthread_spin_unlock(&tpool_ptr->workers.lock);
-    // update active thread amount
-    pthread_spin_lock(&tpool_ptr->count_lock);
-    tpool_ptr->num_threads--;
-    pthread_spin_unlock(&tpool_ptr->count_lock);
-    if (!tpool_ptr->is_static)
-        remove_tracee(worker_pid);
+    pthread_mutex_unlock(&recorder->lock);
 }
 
-/**
- * worker list must be locked/unlocked by caller
- * @param worker_id
- * @param tpool_ptr
+/*
+ * samples the calling worker if the interval passed (or always for the final sample)
  */
-static void remove_worker(size_t worker_id, tpool *tpool_ptr)
+static void report_metrics(tpool *tpool_ptr, worker_state *state, size_t wid, uint64_t *last_sample_ms, bool final)
 {
-    worker *current = tpool_ptr->workers.first;
-    worker *last = NULL;
-    while (current != NULL)
+    if (tpool_ptr->config.metrics_callback == NULL)
     {
-        if (current->wid == worker_id)
+        return;
+    }
+    uint64_t now_ms = monotonic_time_ms();
+    if (!final && now_ms - *last_sample_ms < tpool_ptr->config.metrics_interval_ms)
+    {
+        return;
+    }
+    *last_sample_ms = now_ms;
+    tpool_worker_metrics metrics;
+    tpool_sample_thread_metrics(&metrics);
+    metrics.wid = wid;
+    metrics.final = final;
+    memcpy(metrics.classes, state->classes, sizeof(metrics.classes));
+    tpool_ptr->config.metrics_callback(&metrics, tpool_ptr->config.metrics_ctx);
+}
+
+/*
+ * no-op unless event tracing is configured
+ */
+static void record_event(tpool *tpool_ptr, event_type type, uint64_t arg, int64_t value)
+{
+    if (tpool_ptr->events != NULL)
+    {
+        event_record(tpool_ptr->events, type, arg, value);
+    }
+}
+
+static void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * spins with exponential backoff for up to the worker's spin budget,
+ * the budget follows the share of recent idle periods that spinning ended
+ * @param hit_rate: the worker's running average, SPIN_RATE_ONE when every spin found work
+ * @return true if a job (or the stop request) showed up while spinning
+ */
+static bool spin_for_job(tpool *tpool_ptr, uint32_t *hit_rate)
+{
+    size_t spin_min = tpool_ptr->config.spin_min;
+    size_t spin_max = tpool_ptr->config.spin_max;
+    if (spin_max == 0)
+    {
+        return false;
+    }
+    // never below spin_min, a pool that went quiet keeps probing whether spinning pays off again
+    size_t budget = spin_min + (spin_max > spin_min ? (spin_max - spin_min) * *hit_rate / SPIN_RATE_ONE : 0);
+    size_t spent = 0;
+    size_t backoff = 1;
+    bool found = false;
+    while (spent < budget)
+    {
+        for (size_t i = 0; i < backoff; i++)
         {
-            // if first
-            if (last == NULL)
-            {
-                tpool_ptr->workers.first = current->next;
-            }
-            else
-            {
-                last->next = current->next;
-            }
-            // if last
-            if (current->next == NULL)
-            {
-                tpool_ptr->workers.last = last;
-            }
-            free(current);
-            tpool_ptr->workers.amount -= 1;
+            cpu_relax();
+        }
+        spent += backoff;
+        if (tpool_ptr->jobqueue.size != 0 || tpool_ptr->stopping)
+        {
+            found = true;
             break;
         }
-        last = current;
-        current = current->next;
+        if (backoff < SPIN_BACKOFF_MAX)
+        {
+            backoff <<= 1;
+        }
     }
+    // exponential moving average over roughly the last 8 idle periods, rounded up so it reaches 0 and 1
+    if (found)
+        *hit_rate += (SPIN_RATE_ONE - *hit_rate + 7) / 8;
+    else
+        *hit_rate -= (*hit_rate + 7) / 8;
+    atomic_fetch_add_explicit(found ? &tpool_ptr->spin_hits : &tpool_ptr->spin_misses, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&tpool_ptr->spin_pauses, spent, memory_order_relaxed);
+    return found;
 }
 
-/**
- * worker list must be locked/unlocked by caller
- * @param tpool_ptr
+/*
+ * sleeps on the queue's futex until a push, the stop request or PARK_TIMEOUT_MS
  */
-static void add_extra_worker(tpool *tpool_ptr)
+static void park_for_job(tpool *tpool_ptr)
 {
-    pthread_t thread;
-    worker *new_worker = malloc(sizeof(worker));
-    new_worker->wid = tpool_ptr->workers.max_id + 1;
-    new_worker->next = NULL;
+    jobqueue *jq = &tpool_ptr->jobqueue;
+    // announce first: a pusher that misses the announcement bumped not_empty before it was sampled
+    atomic_fetch_add(&jq->parked_workers, 1);
+    uint32_t seen = atomic_load(&jq->not_empty);
+    if (jq->size == 0 && !tpool_ptr->stopping)
+    {
+        struct timespec timeout = {.tv_sec = PARK_TIMEOUT_MS / 1000, .tv_nsec = (PARK_TIMEOUT_MS % 1000) * 1000000};
+        syscall(SYS_futex, &jq->not_empty, FUTEX_WAIT_PRIVATE, seen, &timeout, NULL, 0);
+    }
+    atomic_fetch_sub(&jq->parked_workers, 1);
+}
 
-    debug_print("creating worker %zu\n", new_worker->wid);
-    worker_args *worker_args_ptr = malloc(sizeof(worker_args));
-    worker_args_ptr->tp = tpool_ptr;
-    worker_args_ptr->wid = new_worker->wid;
+/*
+ * sleeps while only jobs of classes at their limit are queued, until a push, a released class slot,
+ * the stop request or PARK_TIMEOUT_MS
+ * @param seen: not_empty sampled before the queue was scanned, a slot released since then wakes right away
+ */
+static void park_until_admitted(tpool *tpool_ptr, uint32_t seen)
+{
+    jobqueue *jq = &tpool_ptr->jobqueue;
+    atomic_fetch_add(&jq->parked_workers, 1);
+    if (!tpool_ptr->stopping)
+    {
+        struct timespec timeout = {.tv_sec = PARK_TIMEOUT_MS / 1000, .tv_nsec = (PARK_TIMEOUT_MS % 1000) * 1000000};
+        syscall(SYS_futex, &jq->not_empty, FUTEX_WAIT_PRIVATE, seen, &timeout, NULL, 0);
+    }
+    atomic_fetch_sub(&jq->parked_workers, 1);
+}
 
-    debug_print("creating worker %zu's pthread\n", new_worker->wid);
-    pthread_create(&thread, NULL, (void *(*)(void *))worker_function, (void *)worker_args_ptr);
-    pthread_detach(thread);
-    new_worker->thread = thread;
+/*
+ * wakes parked workers after a push, call after releasing the jobqueue lock
+ */
+static void notify_not_empty(jobqueue *jq, int amount)
+{
+    if (amount > 0 && atomic_load(&jq->parked_workers) > 0)
+    {
+        syscall(SYS_futex, &jq->not_empty, FUTEX_WAKE_PRIVATE, amount, NULL, NULL, 0);
+    }
+}
 
-    pthread_spin_lock(&tpool_ptr->count_lock);
-    tpool_ptr->num_threads += 1;
-    pthread_spin_unlock(&tpool_ptr->count_lock);
+/*
+ * allocates the worker's arena and runs the worker_init hook, an arena that can not
+ * be allocated just sends every tpool_arena_alloc to malloc
+ */
+static void init_worker_state(tpool *tpool_ptr, worker_state *state, size_t wid)
+{
+    size_t arena_size = (tpool_ptr->config.arena_size + JOB_CACHE_LINE - 1) & ~(size_t)(JOB_CACHE_LINE - 1);
+    state->tp = tpool_ptr;
+    state->local = NULL;
+    state->arena = arena_size > 0 ? aligned_alloc(JOB_CACHE_LINE, arena_size) : NULL;
+    state->arena_size = state->arena != NULL ? arena_size : 0;
+    state->arena_used = 0;
+    state->overflow = NULL;
+    // the fd is bound to the thread that opened it
+    state->io_fd = tpool_ptr->config.class_accounting ? thread_io_open() : -1;
+    memset(state->classes, 0, sizeof(state->classes));
+    current_worker = state;
+    if (tpool_ptr->config.worker_init != NULL)
+    {
+        state->local = tpool_ptr->config.worker_init(wid, tpool_ptr->config.worker_ctx);
+    }
+}
 
-    // append worker to worker list
-    tpool_ptr->workers.last->next = new_worker;
-    tpool_ptr->workers.last = new_worker;
-    tpool_ptr->workers.amount += 1;
-    tpool_ptr->workers.max_id = new_worker->wid;
+/*
+ * adds a finished user job to the worker's class counters
+ * @param io_before: NULL if the io counters could not be read before the job
+ */
+static void account_job(worker_state *state, uint32_t job_class, uint64_t start_ns, const tpool_worker_metrics *io_before)
+{
+    tpool_class_metrics *metrics = &state->classes[job_class];
+    tpool_worker_metrics io_after;
+    metrics->executed++;
+    metrics->exec_time_ns += monotonic_time_ns() - start_ns;
+    if (io_before != NULL && thread_io_read(state->io_fd, &io_after))
+    {
+        metrics->read_bytes += io_after.read_bytes - io_before->read_bytes;
+        metrics->write_bytes += io_after.write_bytes - io_before->write_bytes;
+        metrics->syscr += io_after.syscr - io_before->syscr;
+        metrics->syscw += io_after.syscw - io_before->syscw;
+    }
+}
+
+static void reset_arena(worker_state *state)
+{
+    state->arena_used = 0;
+    while (state->overflow != NULL)
+    {
+        arena_overflow *next = state->overflow->next;
+        free(state->overflow);
+        state->overflow = next;
+    }
 }
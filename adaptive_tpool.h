@@ -7,17 +7,230 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #include "adapter.h"
 
 // make this a parameter later
 #define MAX_SIZE 64
 
+#define TPOOL_DEFAULT_FIBER_STACK (64 * 1024)
+
+// pause instructions an idle worker spins for before parking, scaled between min and max by its recent hit rate
+#define TPOOL_DEFAULT_SPIN_MIN 64
+#define TPOOL_DEFAULT_SPIN_MAX 4096
+
+// arguments of tpool_submit_job_copy up to this size keep the job node within 64 bytes (one cache line),
+// larger ones just make the node larger, it stays a single allocation
+#define TPOOL_INLINE_ARG_SIZE 16
+
+// classes of tpool_submit_job_class, class 0 is all untagged work (plain submits, strands, timers, fibers)
+#define TPOOL_MAX_CLASSES 8
+
 // the thread pool
 typedef struct tpool *threadpool;
 
 // function that can be submitted
 typedef void (*tfunc)(void *arg);
 
+// constructs the argument of tpool_submit_job_emplace in place, e.g. a C++ placement new
+typedef void (*tpool_arg_init_fn)(void *arg, void *ctx);
+
+// handle of a delayed or periodic job, 0 is never a valid handle
+typedef uint64_t tpool_timer;
+
+// serial executor on top of the pool, see tpool_strand_create
+typedef struct tpool_strand_t *tpool_strand;
+
+// cancel handle of a queued job, see tpool_submit_job_until
+typedef struct tpool_job_ctl *tpool_job_handle;
+
+// why a job was discarded instead of executed
+typedef enum tpool_drop_reason
+{
+    // tpool_cancel_job won against the dequeue
+    TPOOL_DROP_CANCELLED,
+    // dequeued after its deadline
+    TPOOL_DROP_EXPIRED
+} tpool_drop_reason;
+
+// called on the worker that dequeued the dropped job, e.g. to free f_arg
+typedef void (*tpool_drop_fn)(tfunc f, void *f_arg, tpool_drop_reason reason, void *ctx);
+
+/**
+ * work of one job class on one worker, io fields are /proc/thread-self/io deltas around the jobs
+ */
+typedef struct tpool_class_metrics
+{
+    uint64_t executed;
+    /** wall clock time inside the jobs */
+    uint64_t exec_time_ns;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t syscr;
+    uint64_t syscw;
+} tpool_class_metrics;
+
+/**
+ * cumulative counters of one worker thread since it started
+ * collected in-process from /proc/thread-self/{io,schedstat,stat} and getrusage(RUSAGE_THREAD)
+ */
+typedef struct tpool_worker_metrics
+{
+    size_t wid;
+    int32_t tid;
+    /** wall clock (CLOCK_REALTIME) */
+    uint64_t timestamp_ms;
+    /** last sample of a worker, taken right before it exits */
+    bool final;
+    // io
+    uint64_t rchar;
+    uint64_t wchar;
+    uint64_t syscr;
+    uint64_t syscw;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t cancelled_write_bytes;
+    // schedstat
+    uint64_t cpu_time_ns;
+    uint64_t run_delay_ns;
+    uint64_t timeslices;
+    // stat
+    uint64_t blkio_delay_ticks;
+    // rusage
+    uint64_t utime_us;
+    uint64_t stime_us;
+    uint64_t voluntary_ctxt_switches;
+    uint64_t involuntary_ctxt_switches;
+    /** user jobs run by the worker per class, only counted with config.class_accounting */
+    tpool_class_metrics classes[TPOOL_MAX_CLASSES];
+} tpool_worker_metrics;
+
+// called on the sampled worker's own thread, concurrently for different workers
+typedef void (*tpool_metrics_fn)(const tpool_worker_metrics *metrics, void *ctx);
+
+/**
+ * system and cgroup load, all counters are cumulative, sources that are unavailable stay 0
+ */
+typedef struct tpool_pressure
+{
+    /** CLOCK_MONOTONIC */
+    uint64_t timestamp_us;
+    /** stall time from /proc/pressure: some = at least one task stalled, full = all non-idle tasks stalled */
+    uint64_t cpu_some_us;
+    uint64_t io_some_us;
+    uint64_t io_full_us;
+    /** memory.pressure of the process' cgroup, /proc/pressure/memory without cgroup v2 */
+    uint64_t memory_some_us;
+    uint64_t memory_full_us;
+    /** cgroup v2 cpu.max quota / period, 0 if unlimited */
+    double cpu_quota;
+    /** cgroup v2 io.stat summed over all devices */
+    uint64_t io_read_bytes;
+    uint64_t io_write_bytes;
+    uint64_t io_read_ops;
+    uint64_t io_write_ops;
+} tpool_pressure;
+
+// runs on a new worker thread before its first job, the result is the worker's tpool_worker_local()
+typedef void *(*tpool_worker_init_fn)(size_t wid, void *ctx);
+
+// runs on the worker thread after its last job, also for workers removed by scaling
+typedef void (*tpool_worker_exit_fn)(void *local, size_t wid, void *ctx);
+
+// what tpool_submit_job does when a bounded jobqueue is full
+typedef enum tpool_overflow_mode
+{
+    // wait (futex) until a worker pops a job
+    TPOOL_OVERFLOW_BLOCK,
+    // return false right away
+    TPOOL_OVERFLOW_FAIL,
+    // execute the job on the submitting thread, fiber jobs are never run inline and block instead
+    TPOOL_OVERFLOW_RUN_INLINE
+} tpool_overflow_mode;
+
+typedef struct tpool_config
+{
+    /** initial size */
+    size_t size;
+    /** null keeps the pool size static */
+    AdapterParameters *adapter_params;
+    const char *adapter_algo_params;
+    /** max amount of queued jobs, 0 for an unbounded queue */
+    size_t queue_capacity;
+    tpool_overflow_mode overflow_mode;
+    /** stack size of fiber jobs, stacks are pooled and reused */
+    size_t fiber_stack_size;
+    /** null disables sampling, otherwise every worker reports its metrics
+     * every metrics_interval_ms (checked with the scaling advice) and once when exiting */
+    tpool_metrics_fn metrics_callback;
+    void *metrics_ctx;
+    uint64_t metrics_interval_ms;
+    /** scheduler events kept per thread (ring buffer), 0 disables event tracing */
+    size_t trace_buffer_events;
+    /** null: only dumped by tpool_dump_trace, otherwise also written here by tpool_destroy */
+    const char *trace_path;
+    /** null: cancelled and expired jobs are dropped silently */
+    tpool_drop_fn drop_callback;
+    void *drop_ctx;
+    /** null: the pool scales on its own, otherwise the shm_open name of a budget shared with
+     * other adaptive pools (any process of the same user) whose scaling is clamped to this pool's share */
+    const char *budget_name;
+    /** total threads of all pools sharing budget_name, 0 to join an existing budget */
+    size_t budget_threads;
+    /** spin budget of idle workers in pause instructions, spin_max 0 (forced on single cpu machines) parks right away */
+    size_t spin_min;
+    size_t spin_max;
+    /** null: no per-worker state, tpool_worker_local() returns NULL */
+    tpool_worker_init_fn worker_init;
+    tpool_worker_exit_fn worker_exit;
+    void *worker_ctx;
+    /** bytes of each worker's job arena, 0: every tpool_arena_alloc falls back to malloc */
+    size_t arena_size;
+    /** adaptive pools only: clamp scaling advice with tpool_sample_pressure, sampled every pressure_interval_ms (at least 10) */
+    bool pressure_aware;
+    uint64_t pressure_interval_ms;
+    /** size limit per cpu of the cgroup's cpu.max quota, 0 ignores the quota */
+    double quota_threads_per_cpu;
+    /** share of time (0..1) with all tasks stalled on io / some task stalled on memory above which the pool stops growing */
+    double io_pressure_max;
+    double memory_pressure_max;
+    /** attribute execution time and io of user jobs to their class in the worker metrics,
+     * costs two reads of /proc/thread-self/io per job */
+    bool class_accounting;
+    /** max jobs of a class running at once, 0 for no limit, class 0 is never limited, see tpool_set_class_limit */
+    size_t class_limits[TPOOL_MAX_CLASSES];
+} tpool_config;
+
+// snapshot of pool counters, values may be stale as soon as they are read
+typedef struct tpool_stats
+{
+    size_t num_threads;
+    size_t num_busy_threads;
+    size_t queue_depth;
+    /** largest queue depth seen since creation */
+    size_t queue_high_water;
+    /** jobs discarded at dequeue since creation */
+    size_t jobs_cancelled;
+    size_t jobs_expired;
+    /** threads this pool may currently use of the shared budget, 0 without a budget */
+    size_t budget_share;
+    /** idle periods that ended while spinning / by parking, pause instructions spent spinning */
+    size_t spin_hits;
+    size_t spin_misses;
+    size_t spin_pauses;
+    /** arena allocations that did not fit and were malloc'd, a hint to raise arena_size */
+    size_t arena_overflows;
+    /** size limit from pressure and cpu quota, 0 if there is none */
+    size_t pressure_cap;
+    /** jobs of each class currently executing (class 0 is not tracked) */
+    size_t class_running[TPOOL_MAX_CLASSES];
+} tpool_stats;
+
 /**
  * @param size: initial size
  * @param adapter_params: parameters for adapter
@@ -26,13 +239,196 @@ typedef void (*tfunc)(void *arg);
  */
 threadpool tpool_create(size_t size, AdapterParameters *adapter_params, const char *adapter_algo_params);
 
+// fill config with defaults: static pool of given size, unbounded queue
+void tpool_config_init(tpool_config *config, size_t size);
+
+threadpool tpool_create_with_config(const tpool_config *config);
+
 // destroy pool, let all threads finish current work and then exit
 void tpool_destroy(threadpool tpool);
 
-// submit work to the pool
+/**
+ * submit work to the pool
+ * on a full bounded queue the configured overflow mode applies
+ * @return false if the job was not accepted
+ */
 bool tpool_submit_job(threadpool tpool, tfunc f, void *f_arg);
 
+/**
+ * submit work tagged with a class, its metrics are attributed to the class
+ * and it only starts while fewer jobs of its class than the class limit are running,
+ * jobs of a class at its limit stay queued while later jobs of other classes run
+ * (the run inline overflow mode ignores the limit)
+ * @param job_class: below TPOOL_MAX_CLASSES
+ * @return false like tpool_submit_job or if the class is out of range
+ */
+bool tpool_submit_job_class(threadpool tpool, uint32_t job_class, tfunc f, void *f_arg);
+
+/**
+ * change a class's concurrency limit at runtime, e.g. to cap fsync writers while readers scale,
+ * jobs already running are not affected by a lower limit
+ * @param limit: 0 for no limit
+ * @return false for class 0 or a class out of range
+ */
+bool tpool_set_class_limit(threadpool tpool, uint32_t job_class, size_t limit);
+
+/**
+ * submit work that gets a private copy of len bytes at arg_bytes as its argument,
+ * the caller's buffer can be reused as soon as this returns
+ * the copy shares the job node's allocation and is freed once f (or the drop callback) returns
+ * @return false like tpool_submit_job
+ */
+bool tpool_submit_job_copy(threadpool tpool, tfunc f, const void *arg_bytes, size_t len);
+
+/**
+ * submit work whose argument is constructed by init(arg, ctx) right inside the job node
+ * and destroyed by dispose(arg) when the node is freed: after f returned, or without f running
+ * if the job is rejected or still queued when the pool is destroyed
+ * the node holds a dispose pointer in front of the argument (16 bytes), then the argument
+ * @param len: size of the argument, it is aligned for max_align_t
+ * @param dispose: NULL if the argument needs no cleanup
+ * @return false like tpool_submit_job (dispose already ran)
+ */
+bool tpool_submit_job_emplace(threadpool tpool, tfunc f, size_t len, tpool_arg_init_fn init, void *ctx, tfunc dispose);
+
+/**
+ * submit work that runs as a fiber on a small pooled stack
+ * the job may suspend with tpool_yield/tpool_await_fd and is resumed by any worker,
+ * so it must not rely on thread identity (thread locals, held mutexes) across suspends
+ * on a full bounded queue TPOOL_OVERFLOW_RUN_INLINE behaves like TPOOL_OVERFLOW_BLOCK for fibers
+ */
+bool tpool_submit_fiber(threadpool tpool, tfunc f, void *f_arg);
+
+/**
+ * inside a fiber job: requeue the job at the tail and let other jobs run
+ * @return false (and does nothing) when not called from a fiber job
+ */
+bool tpool_yield(void);
+
+/**
+ * inside a fiber job: suspend until fd is ready for events (EPOLLIN/EPOLLOUT),
+ * the worker is free to run other jobs meanwhile
+ * only one fiber may await the same fd at a time
+ * @return false (and does nothing) when not called from a fiber job
+ */
+bool tpool_await_fd(int fd, uint32_t events);
+
+/**
+ * create a strand: jobs submitted to it run in FIFO order and never concurrently,
+ * but on the pool's shared workers (no worker ever blocks waiting for the strand)
+ * @return NULL if out of memory
+ */
+tpool_strand tpool_strand_create(threadpool tpool);
+
+/**
+ * submit work to the strand, lock-free, bypasses the queue capacity
+ * @return false if out of memory
+ */
+bool tpool_strand_submit(tpool_strand strand, tfunc f, void *f_arg);
+
+// strand is freed once all jobs submitted before have run, it must not be used afterwards
+// tpool_destroy frees strands that still have jobs queued (without running them), their handles are invalid then
+void tpool_strand_destroy(tpool_strand strand);
+
+/**
+ * start logging every submit (tpool_submit_job, tpool_submit_fiber, strands) with its
+ * arrival time and job class to a compact binary file, see arrival_trace.h
+ * the class is the index of the job function in order of first appearance
+ * @return false if already recording or the file can not be created
+ */
+bool tpool_record_arrivals(threadpool tpool, const char *path);
+
+// flush and close the arrival trace, called by tpool_destroy as well
+void tpool_stop_recording_arrivals(threadpool tpool);
+
+/**
+ * submit work that is queued once delay_ms milliseconds have passed
+ * the delay is kept by the pool's timer thread, no worker is blocked meanwhile
+ * @return handle for tpool_cancel_timer, 0 on failure
+ */
+tpool_timer tpool_submit_after(threadpool tpool, uint64_t delay_ms, tfunc f, void *f_arg);
+
+/**
+ * submit work that is queued every period_ms milliseconds (first time after one period)
+ * until the timer is cancelled or the pool destroyed
+ * @return handle for tpool_cancel_timer, 0 on failure
+ */
+tpool_timer tpool_submit_every(threadpool tpool, uint64_t period_ms, tfunc f, void *f_arg);
+
+/**
+ * cancel a delayed or periodic job, jobs already handed to the queue still run
+ * @return false if the timer already fired (one-shot) or was cancelled before
+ */
+bool tpool_cancel_timer(threadpool tpool, tpool_timer timer);
+
+// monotonic clock the pool uses for deadlines
+uint64_t tpool_now_ms(void);
+
+/**
+ * submit work that is dropped instead of executed if no worker dequeued it by deadline_ms
+ * cancelled or expired jobs stay queued until a worker discards them, then the drop callback is called
+ * @param deadline_ms: absolute, see tpool_now_ms, 0 for no deadline
+ * @param handle: if not NULL receives a handle for tpool_cancel_job, must be released with tpool_job_release
+ * @return false like tpool_submit_job (handle is left untouched)
+ */
+bool tpool_submit_job_until(threadpool tpool, uint64_t deadline_ms, tfunc f, void *f_arg, tpool_job_handle *handle);
+
+/**
+ * @return true if the job will not run, false if it already started (or was dropped before)
+ */
+bool tpool_cancel_job(tpool_job_handle handle);
+
+// the handle must not be used afterwards, the job itself is not affected
+void tpool_job_release(tpool_job_handle handle);
+
+/**
+ * add (diff > 0) or remove (diff < 0) workers, clamped to [1, MAX_SIZE]
+ * the adaptive pool calls this on scaling advice, it takes effect asynchronously
+ */
+bool tpool_scale(threadpool tpool, int diff);
+
 // block until all work has been completed
+// (does not wait for delayed jobs that are not due yet)
 void tpool_wait(threadpool tpool);
 
+void tpool_get_stats(threadpool tpool, tpool_stats *stats);
+
+/**
+ * write the recorded scheduler events as Chrome trace JSON (chrome://tracing, ui.perfetto.dev),
+ * can be called while the pool is running
+ * @return false if event tracing is disabled or the file can not be written
+ */
+bool tpool_dump_trace(threadpool tpool, const char *path);
+
+/**
+ * inside a job: the state worker_init returned for the worker running it
+ * @return NULL outside of pool workers or without a worker_init hook
+ */
+void *tpool_worker_local(void);
+
+/**
+ * inside a job: scratch memory from the running worker's arena, no free needed,
+ * it is reclaimed all at once when the job returns
+ * fiber jobs get memory of their own instead (malloc'd), it stays valid across suspends until the fiber finishes
+ * @param alignment: power of two, 0 for max_align_t
+ * @return NULL outside of pool workers (e.g. jobs run inline by a submitter) or if malloc fails
+ */
+void *tpool_arena_alloc(size_t size, size_t alignment);
+
+/**
+ * sample psi and the cgroup v2 files of the calling process
+ * @return false if psi was unavailable, cpu.max and io.stat are optional (controller not enabled)
+ */
+bool tpool_sample_pressure(tpool_pressure *pressure);
+
+/**
+ * sample the calling thread's metrics (wid is left 0)
+ * @return false if a source was unavailable, its fields stay 0
+ */
+bool tpool_sample_thread_metrics(tpool_worker_metrics *metrics);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
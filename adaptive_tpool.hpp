@@ -0,0 +1,295 @@
+//
+// header-only C++17 front end of adaptive_tpool.h
+// callables are constructed right inside the job node (tpool_submit_job_emplace): submitting a lambda
+// costs the node allocation the C api makes anyway, no boxed closure and no std::function call
+//
+
+#ifndef THREADPOOL_ADAPTIVE_TPOOL_HPP
+#define THREADPOOL_ADAPTIVE_TPOOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "adaptive_tpool.h"
+
+namespace adaptive_tpool
+{
+
+namespace detail
+{
+
+// moved or copied into the node as is, construction runs inside the C code and must not throw
+template <typename Fn, typename F>
+inline constexpr bool constructible_in_node =
+    alignof(Fn) <= alignof(std::max_align_t) && std::is_nothrow_constructible_v<Fn, F>;
+
+// all thunks are called from C frames, which can not be unwound: an escaping exception terminates
+
+// ctx points to a typed pointer to the source: a function has no object address that converts to void *
+template <typename Fn, typename F>
+void construct(void *arg, void *ctx) noexcept
+{
+    ::new (arg) Fn(std::forward<F>(**static_cast<std::remove_reference_t<F> **>(ctx)));
+}
+
+template <typename Fn>
+void invoke(void *arg) noexcept
+{
+    (*std::launder(static_cast<Fn *>(arg)))();
+}
+
+template <typename Fn>
+void destroy(void *arg) noexcept
+{
+    std::launder(static_cast<Fn *>(arg))->~Fn();
+}
+
+template <typename Fn>
+constexpr tfunc disposer() noexcept
+{
+    if constexpr (std::is_trivially_destructible_v<Fn>)
+        return nullptr;
+    else
+        return destroy<Fn>;
+}
+
+/**
+ * counts the chunks of a parallel_for down, keeps the first exception
+ */
+class latch
+{
+public:
+    explicit latch(std::size_t count) : count_(count)
+    {
+    }
+
+    void count_down(std::exception_ptr error) noexcept
+    {
+        // under the lock: the waiter may destroy the latch as soon as it sees 0
+        std::lock_guard<std::mutex> guard(lock_);
+        if (error != nullptr && error_ == nullptr)
+        {
+            error_ = std::move(error);
+        }
+        if (--count_ == 0)
+        {
+            done_.notify_all();
+        }
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> guard(lock_);
+        done_.wait(guard, [this] { return count_ == 0; });
+        if (error_ != nullptr)
+        {
+            std::rethrow_exception(error_);
+        }
+    }
+
+private:
+    std::mutex lock_;
+    std::condition_variable done_;
+    std::size_t count_;
+    std::exception_ptr error_;
+};
+
+} // namespace detail
+
+/**
+ * owns a pool, destroying it drops jobs that are still queued (see tpool_destroy)
+ */
+class pool
+{
+public:
+    // static pool of size workers
+    explicit pool(std::size_t size)
+    {
+        tpool_config config;
+        tpool_config_init(&config, size);
+        create(config);
+    }
+
+    explicit pool(const tpool_config &config)
+    {
+        create(config);
+    }
+
+    ~pool()
+    {
+        if (handle_ != nullptr)
+        {
+            tpool_destroy(handle_);
+        }
+    }
+
+    pool(const pool &) = delete;
+    pool &operator=(const pool &) = delete;
+
+    pool(pool &&other) noexcept : handle_(std::exchange(other.handle_, nullptr))
+    {
+    }
+
+    pool &operator=(pool &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle_ != nullptr)
+                tpool_destroy(handle_);
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    // for the parts of the C api without a wrapper (timers, strands, fibers, ...)
+    threadpool native_handle() const noexcept
+    {
+        return handle_;
+    }
+
+    /**
+     * queue a callable taking no arguments, move-only ones included
+     * callables that can be moved (or copied for lvalues) without throwing are constructed in the job node,
+     * others are moved to the heap first, a std::unique_ptr to them then takes their place
+     * an exception escaping the callable terminates the process, use async to get it back
+     * @return false like tpool_submit_job, the callable was destroyed without running then
+     */
+    template <typename F>
+    bool submit(F &&f)
+    {
+        using Fn = std::decay_t<F>;
+        static_assert(std::is_invocable_v<Fn &>, "jobs are called without arguments");
+        if constexpr (detail::constructible_in_node<Fn, F &&>)
+        {
+            // construct runs before tpool_submit_job_emplace returns, the pointer on this frame outlives it
+            std::remove_reference_t<F> *source = std::addressof(f);
+            return tpool_submit_job_emplace(handle_, detail::invoke<Fn>, sizeof(Fn), detail::construct<Fn, F &&>,
+                                            &source, detail::disposer<Fn>());
+        }
+        else
+        {
+            // a throwing construction happens here, on the submitter, where it can propagate
+            auto boxed = std::make_unique<Fn>(std::forward<F>(f));
+            return submit([boxed = std::move(boxed)]() mutable { (*boxed)(); });
+        }
+    }
+
+    /**
+     * queue a callable and get its result (or exception) through a std::future
+     * if the job is rejected the future reports std::future_errc::broken_promise
+     */
+    template <typename F>
+    std::future<std::invoke_result_t<std::decay_t<F> &>> async(F &&f)
+    {
+        using R = std::invoke_result_t<std::decay_t<F> &>;
+        std::packaged_task<R()> task(std::forward<F>(f));
+        std::future<R> result = task.get_future();
+        // the task is a pointer to its shared state, it always fits into the node
+        submit(std::move(task));
+        return result;
+    }
+
+    /**
+     * call body(i) for every i in [first, last), in chunks of grain indices on the workers,
+     * the last chunk on the calling thread, returns once all chunks ran
+     * a chunk the pool rejects runs on the calling thread as well
+     * the first exception thrown by body is rethrown here once the other chunks finished
+     * must not be called from a job of the same pool: the caller blocks until the workers ran the chunks
+     * @param grain: 0 for about four chunks per worker
+     */
+    template <typename Index, typename Body>
+    void parallel_for(Index first, Index last, Body &&body, Index grain = 0)
+    {
+        static_assert(std::is_integral_v<Index>, "parallel_for iterates over an integral range");
+        static_assert(!std::is_same_v<Index, bool>, "parallel_for can not iterate over bool");
+        if (!(first < last))
+        {
+            return;
+        }
+        using Size = std::make_unsigned_t<Index>;
+        // modular arithmetic, correct for any first < last of a signed Index as well
+        const Size count = static_cast<Size>(static_cast<Size>(last) - static_cast<Size>(first));
+        bool auto_grain;
+        if constexpr (std::is_signed_v<Index>)
+            auto_grain = grain <= 0;
+        else
+            auto_grain = grain == 0;
+        Size step = auto_grain ? 0 : static_cast<Size>(grain);
+        if (auto_grain)
+        {
+            tpool_stats stats;
+            tpool_get_stats(handle_, &stats);
+            // in size_t, a narrow Size could not hold the chunk count
+            const std::size_t target = stats.num_threads * 4;
+            step = static_cast<Size>(target > 0 && count / target > 0 ? count / target : 1);
+        }
+        const Size chunks = static_cast<Size>(count / step + (count % step != 0 ? 1 : 0));
+
+        detail::latch remaining(chunks);
+        auto run_chunk = [&body, &remaining](Index begin, Index end) noexcept
+        {
+            std::exception_ptr error;
+            try
+            {
+                for (Index i = begin; i != end; ++i)
+                {
+                    body(i);
+                }
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            remaining.count_down(std::move(error));
+        };
+        // chunk bounds are stepped in Size, the result is always within [first, last]
+        Index begin = first;
+        for (Size chunk = 1; chunk < chunks; chunk++)
+        {
+            const Index end = static_cast<Index>(static_cast<Size>(static_cast<Size>(begin) + step));
+            if (!submit([&run_chunk, begin, end]() noexcept { run_chunk(begin, end); }))
+            {
+                run_chunk(begin, end);
+            }
+            begin = end;
+        }
+        run_chunk(begin, last);
+        remaining.wait();
+    }
+
+    // block until all work has been completed, see tpool_wait
+    void wait()
+    {
+        tpool_wait(handle_);
+    }
+
+    tpool_stats stats() const
+    {
+        tpool_stats result;
+        tpool_get_stats(handle_, &result);
+        return result;
+    }
+
+private:
+    void create(const tpool_config &config)
+    {
+        handle_ = tpool_create_with_config(&config);
+        if (handle_ == nullptr)
+        {
+            throw std::runtime_error("could not create thread pool");
+        }
+    }
+
+    threadpool handle_ = nullptr;
+};
+
+} // namespace adaptive_tpool
+
+#endif //THREADPOOL_ADAPTIVE_TPOOL_HPP
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "arrival_trace.h"
+
+/* ==================== Prototypes ==================== */
+
+static void write_varint(FILE *fp, uint64_t value);
+
+static bool read_varint(FILE *fp, uint64_t *value);
+
+static uint64_t monotonic_time_ns();
+
+/* ====================== API ====================== */
+
+arrival_writer *arrival_writer_open(const char *path)
+{
+    arrival_writer *writer = malloc(sizeof(arrival_writer));
+    if (writer == NULL)
+    {
+        return NULL;
+    }
+    writer->fp = fopen(path, "wb");
+    if (writer->fp == NULL)
+    {
+        free(writer);
+        return NULL;
+    }
+    fwrite(ARRIVAL_TRACE_MAGIC, 1, ARRIVAL_TRACE_MAGIC_LEN, writer->fp);
+    pthread_mutex_init(&writer->lock, NULL);
+    writer->start_ns = monotonic_time_ns();
+    writer->last_ns = writer->start_ns;
+    writer->recorded = 0;
+    return writer;
+}
+
+void arrival_writer_record(arrival_writer *writer, uint32_t job_class)
+{
+    pthread_mutex_lock(&writer->lock);
+    uint64_t now = monotonic_time_ns();
+    write_varint(writer->fp, now - writer->last_ns);
+    write_varint(writer->fp, job_class);
+    writer->last_ns = now;
+    writer->recorded++;
+    pthread_mutex_unlock(&writer->lock);
+}
+
+void arrival_writer_close(arrival_writer *writer)
+{
+    fclose(writer->fp);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer);
+}
+
+bool arrival_reader_open(arrival_reader *reader, const char *path)
+{
+    char magic[ARRIVAL_TRACE_MAGIC_LEN];
+    reader->fp = fopen(path, "rb");
+    if (reader->fp == NULL)
+    {
+        return false;
+    }
+    if (fread(magic, 1, ARRIVAL_TRACE_MAGIC_LEN, reader->fp) != ARRIVAL_TRACE_MAGIC_LEN ||
+        memcmp(magic, ARRIVAL_TRACE_MAGIC, ARRIVAL_TRACE_MAGIC_LEN) != 0)
+    {
+        fclose(reader->fp);
+        return false;
+    }
+    reader->offset_ns = 0;
+    return true;
+}
+
+bool arrival_reader_next(arrival_reader *reader, arrival_record *record)
+{
+    uint64_t delta_ns;
+    uint64_t job_class;
+    if (!read_varint(reader->fp, &delta_ns) || !read_varint(reader->fp, &job_class))
+    {
+        return false;
+    }
+    reader->offset_ns += delta_ns;
+    record->offset_ns = reader->offset_ns;
+    record->job_class = (uint32_t)job_class;
+    return true;
+}
+
+void arrival_reader_close(arrival_reader *reader)
+{
+    fclose(reader->fp);
+}
+
+/* =================== Internal ===================== */
+
+static void write_varint(FILE *fp, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        fputc((int)(value & 0x7f) | 0x80, fp);
+        value >>= 7;
+    }
+    fputc((int)value, fp);
+}
+
+static bool read_varint(FILE *fp, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = fgetc(fp);
+        if (byte == EOF)
+        {
+            return false;
+        }
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t monotonic_time_ns()
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t)spec.tv_sec * 1000000000 + (uint64_t)spec.tv_nsec;
+}
@@ -0,0 +1,64 @@
+//
+// compact binary log of job arrivals, written by the pool and replayed by the benchmark
+//
+// format: 8 byte magic, then one record per arrival:
+//   LEB128 varint: ns since the previous arrival (since recording start for the first)
+//   LEB128 varint: job class
+//
+
+#ifndef THREADPOOL_ARRIVAL_TRACE_H
+#define THREADPOOL_ARRIVAL_TRACE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define ARRIVAL_TRACE_MAGIC "TPARRV1\n"
+#define ARRIVAL_TRACE_MAGIC_LEN 8
+
+typedef struct arrival_record
+{
+    /** ns since recording start */
+    uint64_t offset_ns;
+    uint32_t job_class;
+} arrival_record;
+
+typedef struct arrival_writer
+{
+    pthread_mutex_t lock;
+    FILE *fp;
+    uint64_t start_ns;
+    uint64_t last_ns;
+    size_t recorded;
+} arrival_writer;
+
+typedef struct arrival_reader
+{
+    FILE *fp;
+    uint64_t offset_ns;
+} arrival_reader;
+
+/**
+ * @return NULL if the file can not be created
+ */
+arrival_writer *arrival_writer_open(const char *path);
+
+// thread safe, timestamps are taken under the writer lock so offsets never decrease
+void arrival_writer_record(arrival_writer *writer, uint32_t job_class);
+
+void arrival_writer_close(arrival_writer *writer);
+
+/**
+ * @return false if the file does not exist or is not an arrival trace
+ */
+bool arrival_reader_open(arrival_reader *reader, const char *path);
+
+/**
+ * @return false at end of trace (or on a truncated record)
+ */
+bool arrival_reader_next(arrival_reader *reader, arrival_record *record);
+
+void arrival_reader_close(arrival_reader *reader);
+
+#endif //THREADPOOL_ARRIVAL_TRACE_H
@@ -4,19 +4,75 @@
 #include <unistd.h>
 #include <stdatomic.h>
 #include <string.h>
+#include <time.h>
+#include <syscall.h>
 #include <sys/wait.h>
 
 #include "debug_macro.h"
 #include "adapter.h"
 #include "adaptive_tpool.h"
+#include "arrival_trace.h"
+#include "interval_trace.h"
+#include "workloads.h"
+
+// replay sleeps until this close to an arrival, then spins
+#define REPLAY_SPIN_NS 200000
+// per-worker scratch memory of the workloads, larger blocks are malloc'd by the arena
+#define WORKER_ARENA_SIZE (256 * 1024)
 
 char *OUTPUT_DIR;
+// optional 8th argument: trace to replay, or where to record the arrivals of other tests
+char *ARRIVAL_TRACE = NULL;
 bool exiting = false;
 bool benchmark_running = false;
+// selected by the worker_function argument
+const workload *WORKLOAD;
+
+/**
+ * in-process replacement for systemtap + pidstat_lite, enabled by the METRICS_PREFIX env variable
+ * keeps the latest sample of every worker, written out at exit in the format of the traced runs
+ */
+typedef struct metrics_collector
+{
+    pthread_mutex_t lock;
+    char *prefix;
+    uint64_t start_ms;
+    /** time series of all samples */
+    FILE *samples;
+    /** latest sample per worker id */
+    tpool_worker_metrics *latest;
+    size_t capacity;
+    /** false in processes of the x2 tests that never create a pool */
+    bool used;
+    /** adapter intervals + pool state for the simulator, stays empty for static pools */
+    FILE *intervals;
+    /** pool the intervals belong to, NULL once it is being destroyed */
+    threadpool pool;
+} metrics_collector;
+
+metrics_collector METRICS = {.lock = PTHREAD_MUTEX_INITIALIZER, .prefix = NULL};
+
+/**
+ * records every interval the adapter measured together with the pool state when tracing is on
+ */
+void record_interval(const IntervalDataFFI *data)
+{
+    metrics_collector *collector = &METRICS;
+    tpool_stats stats;
+    pthread_mutex_lock(&collector->lock);
+    if (collector->intervals != NULL && collector->pool != NULL)
+    {
+        tpool_get_stats(collector->pool, &stats);
+        // the benchmark adapter tracks exactly one syscall, see get_adapter_params
+        interval_trace_write(collector->intervals, data, 1, stats.num_threads, stats.num_busy_threads, stats.queue_depth);
+    }
+    pthread_mutex_unlock(&collector->lock);
+}
 
 IntervalDerivedData calc_metrics(const IntervalDataFFI *data)
 {
     IntervalDerivedData derived;
+    record_interval(data);
     derived.reset_metric = (double)data->write_bytes;
     derived.scale_metric = (double)data->write_bytes;
     return derived;
@@ -64,85 +120,230 @@ void spawn_background_writer(void *id)
     pthread_create(&background_thread, NULL, (void *(*)(void *))background_writer, (void *)id);
 }
 
-/**
- * writes 100kb file line by line with fsyncing every line
- */
-void worker_write_synced(void *arg)
+uint64_t realtime_ms()
 {
-    int *valp = arg;
-    debug_print("%s %d\n", "user function start", *valp);
-    char filename[50];
-    if (benchmark_running) {
-        sprintf(filename, "%s-b/wout%d", OUTPUT_DIR, *valp);
+    struct timespec spec;
+    clock_gettime(CLOCK_REALTIME, &spec);
+    return (uint64_t)spec.tv_sec * 1000 + (uint64_t)spec.tv_nsec / 1000000;
+}
+
+void collect_metrics(const tpool_worker_metrics *metrics, void *ctx)
+{
+    metrics_collector *collector = ctx;
+    pthread_mutex_lock(&collector->lock);
+    if (metrics->wid >= collector->capacity)
+    {
+        size_t capacity = metrics->wid * 2 + 16;
+        collector->latest = realloc(collector->latest, capacity * sizeof(tpool_worker_metrics));
+        memset(collector->latest + collector->capacity, 0, (capacity - collector->capacity) * sizeof(tpool_worker_metrics));
+        collector->capacity = capacity;
     }
-    else {
-        sprintf(filename, "%s/wout%d", OUTPUT_DIR, *valp);
+    collector->latest[metrics->wid] = *metrics;
+    if (collector->samples != NULL)
+    {
+        fprintf(collector->samples, "%lu %zu %d %lu %lu %lu %lu %lu %lu %lu %lu %lu\n",
+                metrics->timestamp_ms - collector->start_ms, metrics->wid, metrics->tid,
+                metrics->read_bytes, metrics->write_bytes, metrics->syscr, metrics->syscw,
+                metrics->blkio_delay_ticks, metrics->cpu_time_ns, metrics->run_delay_ns,
+                metrics->voluntary_ctxt_switches, metrics->involuntary_ctxt_switches);
     }
-    printf("opening file %s\n", filename);
-    FILE *fp = fopen(filename, "w");
-    int fd = fileno(fp);
-    // roughly 100Kb
-    for (int i = 0; i < 7000; ++i)
+    pthread_mutex_unlock(&collector->lock);
+}
+
+void open_metrics_files(metrics_collector *collector)
+{
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s%s-workerstats.txt", collector->prefix, benchmark_running ? "-b" : "");
+    collector->samples = fopen(filename, "w");
+    snprintf(filename, sizeof(filename), "%s%s-intervals.txt", collector->prefix, benchmark_running ? "-b" : "");
+    collector->intervals = fopen(filename, "w");
+    if (collector->intervals != NULL)
     {
-        fputs("this is a line\n", fp);
-        fsync(fd);
+        interval_trace_write_header(collector->intervals);
+    }
+    if (collector->samples != NULL)
+    {
+        fprintf(collector->samples, "ms wid tid read_bytes write_bytes syscr syscw blkio_delays cpu_ns run_delay_ns vol_ctx non_vol_ctx\n");
     }
-    debug_print("%s %d\n", "user function end", *valp);
 }
 
 /**
- * reads an input file line by line using a single 4kb buffer
+ * atexit handler, writes the per run files the traced benchmark scripts produce
+ * (x2 tests: the second process writes to <prefix>-b-*)
+ * syscall times are not available in-process, only read/write counts with time 0
  */
-void worker_read_buffered(void *arg)
+void write_metrics_files()
 {
-    int *valp = arg;
-    char filename[50];
-    char buffer[4096];
-    debug_print("%s %d\n", "buffered read function start", *valp);
-    sprintf(filename, "%s/rin%d", OUTPUT_DIR, *valp);
-    debug_print("%s %d\n", "buffered read printed filename", *valp);
-    FILE *fp = fopen(filename, "r");
-    debug_print("%s %d\n", "buffered read opened file", *valp);
-    if (fp == NULL)
+    metrics_collector *collector = &METRICS;
+    char filename[256];
+    tpool_worker_metrics main_thread;
+    if (!collector->used)
     {
-        debug_print("%s\n", "file nULL");
+        return;
     }
-    while (fgets(buffer, 4096, fp) != NULL)
+    tpool_sample_thread_metrics(&main_thread);
+    pthread_mutex_lock(&collector->lock);
+    const char *suffix = benchmark_running ? "-b" : "";
+    uint64_t total_syscr = 0;
+    uint64_t total_syscw = 0;
+
+    snprintf(filename, sizeof(filename), "%s%s-pidstats.txt", collector->prefix, suffix);
+    FILE *fp = fopen(filename, "w");
+    if (fp != NULL)
+    {
+        fprintf(fp, "tracing threads: %d", main_thread.tid);
+        for (size_t i = 0; i < collector->capacity; i++)
+        {
+            if (collector->latest[i].tid != 0)
+                fprintf(fp, ",%d", collector->latest[i].tid);
+        }
+        fprintf(fp, "\nbytes_read, bytes_write, blkio_delays, non-vol ctx switch, vol ctx switc\n");
+        fprintf(fp, "%lu %lu %lu %lu %lu\n", main_thread.read_bytes, main_thread.write_bytes,
+                main_thread.blkio_delay_ticks, main_thread.involuntary_ctxt_switches, main_thread.voluntary_ctxt_switches);
+        for (size_t i = 0; i < collector->capacity; i++)
+        {
+            tpool_worker_metrics *m = &collector->latest[i];
+            if (m->tid == 0)
+                continue;
+            fprintf(fp, "%lu %lu %lu %lu %lu\n", m->read_bytes, m->write_bytes, m->blkio_delay_ticks,
+                    m->involuntary_ctxt_switches, m->voluntary_ctxt_switches);
+            total_syscr += m->syscr;
+            total_syscw += m->syscw;
+        }
+        fclose(fp);
+    }
+
+    snprintf(filename, sizeof(filename), "%s%s-syscalls.txt", collector->prefix, suffix);
+    fp = fopen(filename, "w");
+    if (fp != NULL)
+    {
+        fprintf(fp, "targets: in-process\n");
+        fprintf(fp, "%25s %15s %10s\n", "SYSCALL", "TIME IN MS", "COUNT");
+        // rows with count 0 would break the average in raw_results_to_json.py
+        if (total_syscr > 0)
+            fprintf(fp, "%25s %15d %10lu\n", "read", 0, total_syscr);
+        if (total_syscw > 0)
+            fprintf(fp, "%25s %15d %10lu\n", "write", 0, total_syscw);
+        fprintf(fp, "------------\n");
+        fclose(fp);
+    }
+
+    snprintf(filename, sizeof(filename), "%s%s-runtime_ms.txt", collector->prefix, suffix);
+    fp = fopen(filename, "w");
+    if (fp != NULL)
+    {
+        fprintf(fp, "%lu\n", realtime_ms() - collector->start_ms);
+        fclose(fp);
+    }
+    if (collector->samples != NULL)
+    {
+        fclose(collector->samples);
+        collector->samples = NULL;
+    }
+    if (collector->intervals != NULL)
     {
-        debug_print("%s %d\n", "buffered read", *valp);
+        fclose(collector->intervals);
+        collector->intervals = NULL;
     }
-    debug_print("%s %d\n", "buffered read function end", *valp);
+    pthread_mutex_unlock(&collector->lock);
 }
 
 threadpool get_tpool(int pool_size, char* adapter_algo_params)
 {
+    tpool_config config;
     debug_print("%s\n", "creating tpool");
     if (pool_size > 0)
     {
-        return tpool_create(pool_size, NULL, NULL);
+        tpool_config_init(&config, pool_size);
     }
     else
     {
-        AdapterParameters *adapter_params = get_adapter_params();
-        return tpool_create(1, adapter_params, adapter_algo_params);
+        tpool_config_init(&config, 1);
+        config.adapter_params = get_adapter_params();
+        config.adapter_algo_params = adapter_algo_params;
+    }
+    config.arena_size = WORKER_ARENA_SIZE;
+    char *trace_events = getenv("TRACE_EVENTS");
+    if (trace_events != NULL)
+    {
+        // written by tpool_destroy, the second process of the x2 tests gets its own file
+        static char trace_path[256];
+        snprintf(trace_path, sizeof(trace_path), "%s%s", trace_events, benchmark_running ? "-b" : "");
+        config.trace_buffer_events = 1 << 16;
+        config.trace_path = trace_path;
+    }
+    char *thread_budget = getenv("THREAD_BUDGET");
+    if (thread_budget != NULL && pool_size == 0)
+    {
+        // <shm name>:<threads>, both processes of the x2 tests join the same budget
+        static char budget_name[256];
+        snprintf(budget_name, sizeof(budget_name), "%s", thread_budget);
+        char *separator = strrchr(budget_name, ':');
+        if (separator != NULL)
+        {
+            *separator = '\0';
+            config.budget_threads = atoi(separator + 1);
+        }
+        config.budget_name = budget_name;
+    }
+    if (getenv("PRESSURE_AWARE") != NULL && pool_size == 0)
+    {
+        config.pressure_aware = true;
+    }
+    if (METRICS.prefix != NULL)
+    {
+        METRICS.used = true;
+        open_metrics_files(&METRICS);
+        config.metrics_callback = collect_metrics;
+        config.metrics_ctx = &METRICS;
     }
+    threadpool tpool = tpool_create_with_config(&config);
+    pthread_mutex_lock(&METRICS.lock);
+    METRICS.pool = tpool;
+    pthread_mutex_unlock(&METRICS.lock);
+    return tpool;
 }
 
-void delete_files(int num_items)
+/**
+ * pool for the synthetic load patterns, records their arrivals if a trace file was given
+ */
+threadpool get_recording_tpool(int pool_size, char* adapter_algo_params)
 {
-    char filename[50];
-    debug_print("%s\n", "deleting worker output");
-    for (int j = 0; j < num_items; j++)
+    threadpool tpool = get_tpool(pool_size, adapter_algo_params);
+    if (tpool != NULL && ARRIVAL_TRACE != NULL && !tpool_record_arrivals(tpool, ARRIVAL_TRACE))
     {
-        sprintf(filename, "%s/wout%d", OUTPUT_DIR, j);
-        remove(filename);
+        printf("could not record arrivals to %s\n", ARRIVAL_TRACE);
     }
-    if (benchmark_running) {
-        for (int i = 0; i < num_items; i++)
-        {
-            sprintf(filename, "%s-b/wout%d", OUTPUT_DIR, i);
-            remove(filename);
-        }
+    return tpool;
+}
+
+uint64_t monotonic_ns()
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t)spec.tv_sec * 1000000000 + (uint64_t)spec.tv_nsec;
+}
+
+/**
+ * sleeps until shortly before target, then spins, nanosleep alone overshoots by 50us+
+ */
+void wait_until_ns(uint64_t target_ns)
+{
+    if (target_ns > monotonic_ns() + REPLAY_SPIN_NS)
+    {
+        uint64_t wake_ns = target_ns - REPLAY_SPIN_NS;
+        struct timespec wake = {.tv_sec = wake_ns / 1000000000, .tv_nsec = wake_ns % 1000000000};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+    }
+    while (monotonic_ns() < target_ns)
+        ;
+}
+
+void delete_files(int num_items)
+{
+    if (WORKLOAD->cleanup != NULL)
+    {
+        WORKLOAD->cleanup(num_items);
     }
 }
 
@@ -151,6 +352,10 @@ void tpool_wait_destroy(threadpool tpool)
     debug_print("%s\n", "waiting for tpool");
     tpool_wait(tpool);
     debug_print("%s\n", "destroying tpool");
+    // the adapter may still measure an interval, it must not read the freed pool
+    pthread_mutex_lock(&METRICS.lock);
+    METRICS.pool = NULL;
+    pthread_mutex_unlock(&METRICS.lock);
     tpool_destroy(tpool);
 }
 
@@ -161,7 +366,7 @@ void tpool_wait_destroy(threadpool tpool)
 void static_load(int pool_size, char *adapter_algo_params, int num_items, void *worker_function)
 {
     int is[num_items];
-    threadpool tpool = get_tpool(pool_size, adapter_algo_params);
+    threadpool tpool = get_recording_tpool(pool_size, adapter_algo_params);
 
     debug_print("%s\n", "start submitting jobs to tpool");
     for (int i = 0; i < num_items; i++)
@@ -181,7 +386,7 @@ void static_load(int pool_size, char *adapter_algo_params, int num_items, void *
 void inc_load(int pool_size, char *adapter_algo_params, int num_items, void *worker_function)
 {
     int is[num_items];
-    threadpool tpool = get_tpool(pool_size, adapter_algo_params);
+    threadpool tpool = get_recording_tpool(pool_size, adapter_algo_params);
     debug_print("%s\n", "start submitting jobs to tpool");
     for (int i = 0; i < num_items; i++)
     {
@@ -203,7 +408,7 @@ void inc_load(int pool_size, char *adapter_algo_params, int num_items, void *wor
 void low_high_low_load(int pool_size, char *adapter_algo_params, int num_items, void *worker_function)
 {
     int is[num_items];
-    threadpool tpool = get_tpool(pool_size, adapter_algo_params);
+    threadpool tpool = get_recording_tpool(pool_size, adapter_algo_params);
     debug_print("%s\n", "start submitting jobs to tpool");
     for (int i = 0; i < num_items; i++)
     {
@@ -228,7 +433,7 @@ void inc_background_load(int pool_size, char *adapter_algo_params, int num_items
 {
     int is[num_items];
     int background_id = 0;
-    threadpool tpool = get_tpool(pool_size, adapter_algo_params);
+    threadpool tpool = get_recording_tpool(pool_size, adapter_algo_params);
 
     debug_print("%s\n", "start submitting jobs to tpool");
     for (int i = 0; i < num_items; i++)
@@ -252,31 +457,93 @@ void inc_background_load(int pool_size, char *adapter_algo_params, int num_items
     sleep(1);
 }
 
+/**
+ * open-loop replay of a recorded arrival trace: jobs are submitted at their recorded offsets
+ * no matter how far the pool is behind, all classes run the given worker function
+ * @param num_items max amount of arrivals replayed
+ */
+void replay_load(int pool_size, char *adapter_algo_params, int num_items, void *worker_function)
+{
+    arrival_reader reader;
+    if (ARRIVAL_TRACE == NULL || !arrival_reader_open(&reader, ARRIVAL_TRACE))
+    {
+        printf("replay needs a valid arrival trace as 8th argument\n");
+        exit(1);
+    }
+    // read everything up front, file io must not disturb the timing
+    uint64_t *offsets = malloc(num_items * sizeof(uint64_t));
+    arrival_record record;
+    int num_arrivals = 0;
+    while (num_arrivals < num_items && arrival_reader_next(&reader, &record))
+    {
+        offsets[num_arrivals++] = record.offset_ns;
+    }
+    arrival_reader_close(&reader);
+    printf("replaying %d arrivals over %.3f s\n", num_arrivals, num_arrivals > 0 ? offsets[num_arrivals - 1] / 1e9 : 0.0);
+
+    int *is = malloc(num_items * sizeof(int));
+    uint64_t max_lateness_ns = 0;
+    threadpool tpool = get_tpool(pool_size, adapter_algo_params);
+    uint64_t start_ns = monotonic_ns();
+    for (int i = 0; i < num_arrivals; i++)
+    {
+        uint64_t target_ns = start_ns + offsets[i];
+        wait_until_ns(target_ns);
+        uint64_t lateness_ns = monotonic_ns() - target_ns;
+        if (lateness_ns > max_lateness_ns)
+        {
+            max_lateness_ns = lateness_ns;
+        }
+        is[i] = i;
+        tpool_submit_job(tpool, worker_function, &is[i]);
+    }
+    printf("max submit lateness: %lu us\n", max_lateness_ns / 1000);
+    tpool_wait_destroy(tpool);
+    delete_files(num_items);
+    free(is);
+    free(offsets);
+}
+
 int main(int argc, char **argv)
 {
-    if (argc != 7)
+    if (argc != 7 && argc != 8)
     {
-        printf("args: <worker_function> <test_name> <output_dir> <num_items> <static/adaptive> <pool_size/adapter_algo_params>\n");
+        printf("args: <worker_function> <test_name> <output_dir> <num_items> <static/adaptive> <pool_size/adapter_algo_params> [arrival_trace]\n");
         printf("--- if 5th arg \"static\": 6th arg is pool size, if 5th arg \"adaptive\": 6th arg is adapter algorithm parameter string\n");
-        printf("valid worker function:\n");
-        printf("--- worker_write_synced\n");
-        printf("--- worker_read_buffered\n");
+        printf("--- arrival_trace: input of the replay tests, for all other tests the arrivals are recorded to it\n");
+        printf("--- env METRICS_PREFIX=<prefix>: sample worker metrics in-process and write <prefix>-{pidstats,syscalls,runtime_ms,workerstats,intervals}.txt\n");
+        printf("--- env TRACE_EVENTS=<path>: record scheduler events and write them as Chrome trace JSON when the pool is destroyed\n");
+        printf("--- env THREAD_BUDGET=<shm name>:<threads>: adaptive pools of all processes of the user using the same name share <threads>\n");
+        printf("--- env PRESSURE_AWARE=1: adaptive pools stop growing under io/memory pressure and stay within the cgroup cpu quota\n");
+        workload_print_usage();
         printf("valid test names:\n");
         printf("--- adapt_pool-static_load\n");
         printf("--- adapt_pool-inc_load\n");
         printf("--- adapt_pool-low_high_low_load\n");
         printf("--- adapt_pool-inc_background_load\n");
         printf("--- adapt_pool-static_load-x2\n");
+        printf("--- adapt_pool-replay\n");
         printf("--- static_pool-static_load\n");
         printf("--- static_pool-inc_load\n");
         printf("--- static_pool-low_high_low_load\n");
         printf("--- static_pool-inc_background_load\n");
         printf("--- static_pool-static_load-x2\n");
+        printf("--- static_pool-replay\n");
         return -1;
     }
     else
     {
         int num_items = atoi(argv[4]);
+        if (argc == 8)
+        {
+            ARRIVAL_TRACE = argv[7];
+        }
+        METRICS.prefix = getenv("METRICS_PREFIX");
+        if (METRICS.prefix != NULL)
+        {
+            METRICS.start_ms = realtime_ms();
+            atexit(write_metrics_files);
+        }
         int pool_size = 0;
         char *adapter_algo_params = NULL;
         if (strcmp(argv[5], "static") == 0) {
@@ -298,20 +565,18 @@ int main(int argc, char **argv)
         }
         OUTPUT_DIR = output_directory;
         // PARSE WORKER FUNCTION
-        void *worker_function;
-        if (strcmp(argv[1], "worker_write_synced") == 0)
+        WORKLOAD = workload_parse(argv[1]);
+        if (WORKLOAD == NULL)
         {
-            worker_function = worker_write_synced;
-        }
-        else if (strcmp(argv[1], "worker_read_buffered") == 0)
-        {
-            worker_function = worker_read_buffered;
+            printf("invalid worker function\n");
+            exit(1);
         }
-        else
+        workload_set_dirs(OUTPUT_DIR, OUTPUT_DIR);
+        if (WORKLOAD->prepare != NULL && !WORKLOAD->prepare(num_items))
         {
-            printf("invalid worker function\n");
             exit(1);
         }
+        void *worker_function = WORKLOAD->run;
         // PARSE TEST NAME
         if (strcmp(argv[2], "adapt_pool-static_load") == 0)
         {
@@ -333,6 +598,16 @@ int main(int argc, char **argv)
             printf("%s\n", "RUNNING adaptive pool - inc background load");
             inc_background_load(0, adapter_algo_params, num_items, worker_function);
         }
+        else if (strcmp(argv[2], "adapt_pool-replay") == 0)
+        {
+            printf("%s\n", "RUNNING adaptive pool - replay");
+            replay_load(0, adapter_algo_params, num_items, worker_function);
+        }
+        else if (strcmp(argv[2], "static_pool-replay") == 0)
+        {
+            printf("%s\n", "RUNNING static pool - replay");
+            replay_load(pool_size, NULL, num_items, worker_function);
+        }
         else if (strcmp(argv[2], "static_pool-static_load") == 0)
         {
             printf("%s\n", "RUNNING static pool - static load");
@@ -357,12 +632,15 @@ int main(int argc, char **argv)
         {
             pid_t fork_pid, wait_pid;
             int child_status = 0;
+            char second_output_dir[strlen(OUTPUT_DIR) + 3];
+            sprintf(second_output_dir, "%s-b", OUTPUT_DIR);
             printf("%s\n", "RUNNING 2x adaptive pool - static load in parallel");
             for (int i = 0; i < 2; i++)
             {
                 // make sure if running in parallel files are written to different dirs
                 if (i == 1) {
                     benchmark_running = true;
+                    workload_set_dirs(OUTPUT_DIR, second_output_dir);
                 }
                 fork_pid = fork();
                 if (fork_pid > 0)
@@ -378,12 +656,15 @@ int main(int argc, char **argv)
         {
             pid_t fork_pid, wait_pid;
             int child_status = 0;
+            char second_output_dir[strlen(OUTPUT_DIR) + 3];
+            sprintf(second_output_dir, "%s-b", OUTPUT_DIR);
             printf("%s\n", "RUNNING 2x static pool - static load in parallel");
             for (int i = 0; i < 2; i++)
             {
                 // make sure if running in parallel files are written to different dirs
                 if (i == 1) {
                     benchmark_running = true;
+                    workload_set_dirs(OUTPUT_DIR, second_output_dir);
                 }
                 fork_pid = fork();
                 if (fork_pid > 0)
@@ -35,6 +35,8 @@ class BenchmarkRun:
     # keys: write_bytes, read_bytes
     io_throughput: Mapping[str, float]
     iowait: int
+    # optional extra values of a run, e.g. p50_us, p99_us, p999_us, jobs_per_s of tpool_bench
+    metrics: Mapping[str, float] = field(default_factory=dict)
 
     def as_dict(self) -> Dict:
         result = asdict(self)
@@ -68,8 +70,9 @@ def json_to_runs(runs_arr: List) -> List[BenchmarkRun]:
     result = []
     for run in runs_arr:
         sms = [syscall_metrics_from_dict(sm) for sm in run['syscall_metrics']]
+        metrics = {key: float(value) for key, value in run.get('metrics', {}).items()}
         result.append(BenchmarkRun(run['workload'], run['thread_config'], float(run['runtime_s']),
-                                   float(run['avg_latency_ms']), sms, run['io_throughput'], run['iowait']))
+                                   float(run['avg_latency_ms']), sms, run['io_throughput'], run['iowait'], metrics))
     return result
 
 
@@ -137,8 +140,11 @@ def agg_runs(same_config_runs: List[BenchmarkRun], agg_func_str: str) -> Benchma
     aggd_io_throughputs = agg_io_throughputs(
         [run.io_throughput for run in same_config_runs], agg_func_str)
     aggd_iowait = f([run.iowait for run in same_config_runs])
+    # only metrics every run reported
+    metric_keys = set.intersection(*[set(run.metrics.keys()) for run in same_config_runs])
+    aggd_metrics = {key: f([run.metrics[key] for run in same_config_runs]) for key in metric_keys}
     return BenchmarkRun(workload, thread_config, aggd_runtime, aggd_latency,
-                        aggd_sysc_metrics, aggd_io_throughputs, aggd_iowait)
+                        aggd_sysc_metrics, aggd_io_throughputs, aggd_iowait, aggd_metrics)
 
 
 def agg_same_config_runs(runs: List[BenchmarkRun], agg_func_str: str) -> List[BenchmarkRun]:
@@ -0,0 +1,37 @@
+import sys
+
+from generic_data import *
+
+"""
+writes the throughput model of the simulator (../../simulator.c) from the result json of a static pool benchmark
+one line per thread count: threads, jobs/s, read bytes/s, write bytes/s, tracked syscalls/s, tracked syscall ns/s
+"""
+
+MODEL_HEADER = '# tpool throughput model v1\n'
+
+
+def run_to_model_line(run: BenchmarkRun, amount_jobs: int, tracked_syscall: str) -> str:
+    threads = list(run.thread_config.values())[0]
+    calls = get_metric_or_zero(run.syscall_metrics, tracked_syscall, 'nr_calls')
+    call_time_ms = get_metric_or_zero(run.syscall_metrics, tracked_syscall, 'total_time_ms')
+    return f'{threads} {amount_jobs / run.runtime_s} {run.io_throughput["read_bytes"] / run.runtime_s} ' \
+           f'{run.io_throughput["write_bytes"] / run.runtime_s} {calls / run.runtime_s} ' \
+           f'{call_time_ms * 1e6 / run.runtime_s}\n'
+
+
+if __name__ == '__main__':
+    if len(sys.argv) not in (4, 5):
+        print('usage: ./throughput_model.py [result json] [amount jobs per run] [model output] [tracked syscall, default write]')
+        exit(1)
+    result_json_path = sys.argv[1]
+    amount_jobs = int(sys.argv[2])
+    model_path = sys.argv[3]
+    tracked_syscall = sys.argv[4] if len(sys.argv) == 5 else 'write'
+    with open(result_json_path) as f:
+        runs = json_to_runs(json.load(f))
+    # repetitions of the same thread count are averaged
+    avgd = avg_same_config_runs(runs)
+    with open(model_path, 'w') as f:
+        f.write(MODEL_HEADER)
+        for run in avgd:
+            f.write(run_to_model_line(run, amount_jobs, tracked_syscall))
@@ -10,7 +10,9 @@ import subprocess
 import os
 
 
-runscript = 'single_run_with_metrics.sh'
+# INPROCESS_METRICS=1 collects the same files without sudo/systemtap
+inprocess = os.environ.get('INPROCESS_METRICS', '0') == '1'
+runscript = 'single_run_inprocess.sh' if inprocess else 'single_run_with_metrics.sh'
 
 
 @dataclass(frozen=True)
@@ -32,8 +34,9 @@ def get_bench_params(name):
 
 def execute_config(params: BenchmarkParameters, amount_workers: int, output_dir: str):
     prefix = f'{output_dir}/t={amount_workers}'
-    run(['sudo', 'clear_page_cache'])
-    sleep(1)
+    if not inprocess:
+        run(['sudo', 'clear_page_cache'])
+        sleep(1)
     with Popen(['bash', runscript, params.worker_function, params.workload_name, params.files_dir, 
         str(params.amount_files), 'static', str(amount_workers), prefix], text=True, stdout=subprocess.PIPE) as proc:
         # while running continously obtain stdout and buffer it
@@ -44,7 +47,8 @@ def execute_config(params: BenchmarkParameters, amount_workers: int, output_dir:
 
 if __name__ == '__main__':
 
-    print('dont forget to run \'sudo -v\' before')
+    if not inprocess:
+        print('dont forget to run \'sudo -v\' before')
     if len(sys.argv) != 2:
         print('usage: ./run_benchmark.py [benchmark name]')
         exit(1)
@@ -0,0 +1,17 @@
+#!/bin/bash
+# same arguments and result files as single_run_with_metrics.sh, but the pool
+# samples its workers itself (procfs + getrusage), no sudo/systemtap required
+worker_f=$1
+test_name=$2
+out_dir=$3
+num_items=$4
+type=$5
+size_or_params=$6
+output_prefix=$7
+
+start_millis=`date +%s%3N`
+METRICS_PREFIX=$output_prefix ../build/benchmark $worker_f $test_name $out_dir $num_items $type $size_or_params > /dev/null 2> /dev/null < /dev/null
+end_millis=`date +%s%3N`
+# the benchmark writes its own runtime on exit, keep the wall clock one for comparability
+let runtime=$end_millis-$start_millis
+echo $runtime > "${output_prefix}-runtime_ms.txt"
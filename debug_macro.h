@@ -5,7 +5,10 @@
 #ifndef THREADPOOL_DEBUG_MACRO_H
 #define THREADPOOL_DEBUG_MACRO_H
 
+// targets that measure the pool itself build with -DDEBUG=0
+#ifndef DEBUG
 #define DEBUG 1
+#endif
 #define debug_print(fmt, ...) \
         do { if (DEBUG) fprintf(stderr, "%s:%d:%s(): " fmt, __FILE__, \
                                 __LINE__, __func__, __VA_ARGS__); } while (0)
@@ -0,0 +1,258 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "event_trace.h"
+
+/* ==================== Prototypes ==================== */
+
+static event_buffer *thread_buffer(event_recorder *recorder);
+
+static uint64_t read_ticks();
+
+static uint64_t monotonic_time_ns();
+
+static size_t snapshot_buffer(event_buffer *buffer, trace_event *copy);
+
+static void write_event_json(FILE *fp, const trace_event *event, pid_t pid, pid_t tid, double ts_us, bool *first);
+
+/* ==================== Thread locals ==================== */
+
+/** buffer of the calling thread in the recorder with id cached_recorder_id */
+static __thread event_buffer *cached_buffer;
+static __thread uint64_t cached_recorder_id;
+
+/** ids start at 1, 0 never matches a recorder */
+static atomic_uint_fast64_t next_recorder_id = 1;
+
+/* ====================== API ====================== */
+
+event_recorder *event_recorder_create(size_t buffer_events)
+{
+    event_recorder *recorder = malloc(sizeof(event_recorder));
+    if (recorder == NULL)
+    {
+        return NULL;
+    }
+    size_t capacity = 1;
+    while (capacity < buffer_events)
+    {
+        capacity <<= 1;
+    }
+    recorder->id = atomic_fetch_add(&next_recorder_id, 1);
+    pthread_mutex_init(&recorder->lock, NULL);
+    recorder->buffers = NULL;
+    recorder->buffer_events = capacity;
+    recorder->start_ticks = read_ticks();
+    recorder->start_ns = monotonic_time_ns();
+    return recorder;
+}
+
+void event_recorder_destroy(event_recorder *recorder)
+{
+    event_buffer *buffer = recorder->buffers;
+    while (buffer != NULL)
+    {
+        event_buffer *next = buffer->next;
+        free(buffer);
+        buffer = next;
+    }
+    pthread_mutex_destroy(&recorder->lock);
+    free(recorder);
+}
+
+void event_record(event_recorder *recorder, event_type type, uint64_t arg, int64_t value)
+{
+    event_buffer *buffer = cached_recorder_id == recorder->id ? cached_buffer : thread_buffer(recorder);
+    if (buffer == NULL)
+    {
+        return;
+    }
+    uint64_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    trace_event *event = &buffer->events[head & buffer->mask];
+    event->ticks = read_ticks();
+    event->arg = arg;
+    event->value = value;
+    event->type = type;
+    // publishes the event to a concurrent dump
+    atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+bool event_recorder_dump_json(event_recorder *recorder, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    trace_event *copy = malloc(recorder->buffer_events * sizeof(trace_event));
+    if (copy == NULL)
+    {
+        fclose(fp);
+        return false;
+    }
+    // TSC frequency is measured over the recorder's lifetime instead of trusting cpuid
+    uint64_t end_ticks = read_ticks();
+    uint64_t end_ns = monotonic_time_ns();
+    double ns_per_tick = end_ticks > recorder->start_ticks
+                             ? (double)(end_ns - recorder->start_ns) / (double)(end_ticks - recorder->start_ticks)
+                             : 1.0;
+    pid_t pid = getpid();
+    bool first = true;
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    pthread_mutex_lock(&recorder->lock);
+    for (event_buffer *buffer = recorder->buffers; buffer != NULL; buffer = buffer->next)
+    {
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", pid, buffer->tid, buffer->name);
+        first = false;
+        size_t amount = snapshot_buffer(buffer, copy);
+        for (size_t i = 0; i < amount; i++)
+        {
+            // ticks may be slightly before start_ticks on another core, clamp instead of wrapping
+            double delta_ticks = copy[i].ticks > recorder->start_ticks ? (double)(copy[i].ticks - recorder->start_ticks) : 0;
+            write_event_json(fp, &copy[i], pid, buffer->tid, delta_ticks * ns_per_tick / 1000, &first);
+        }
+    }
+    pthread_mutex_unlock(&recorder->lock);
+    fprintf(fp, "\n]}\n");
+    free(copy);
+    return fclose(fp) == 0;
+}
+
+/* =================== Internal ===================== */
+
+/*
+ * slow path of event_record: finds or registers the calling thread's buffer
+ */
+static event_buffer *thread_buffer(event_recorder *recorder)
+{
+    pid_t tid = syscall(__NR_gettid);
+    pthread_mutex_lock(&recorder->lock);
+    event_buffer *buffer = recorder->buffers;
+    while (buffer != NULL && buffer->tid != tid)
+    {
+        buffer = buffer->next;
+    }
+    if (buffer == NULL)
+    {
+        buffer = malloc(sizeof(event_buffer) + recorder->buffer_events * sizeof(trace_event));
+        if (buffer == NULL)
+        {
+            pthread_mutex_unlock(&recorder->lock);
+            return NULL;
+        }
+        buffer->tid = tid;
+        if (pthread_getname_np(pthread_self(), buffer->name, sizeof(buffer->name)) != 0)
+        {
+            snprintf(buffer->name, sizeof(buffer->name), "thread-%d", tid);
+        }
+        buffer->mask = recorder->buffer_events - 1;
+        atomic_init(&buffer->head, 0);
+        buffer->next = recorder->buffers;
+        recorder->buffers = buffer;
+    }
+    pthread_mutex_unlock(&recorder->lock);
+    cached_buffer = buffer;
+    cached_recorder_id = recorder->id;
+    return buffer;
+}
+
+static uint64_t read_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    // invariant TSC is assumed (constant rate, synced across cores) as on all recent x86
+    return __rdtsc();
+#else
+    return monotonic_time_ns();
+#endif
+}
+
+static uint64_t monotonic_time_ns()
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t)spec.tv_sec * 1000000000 + (uint64_t)spec.tv_nsec;
+}
+
+/*
+ * copies the retained events oldest first, dropping slots the owner may have overwritten meanwhile
+ * @return amount of valid events at the start of copy
+ */
+static size_t snapshot_buffer(event_buffer *buffer, trace_event *copy)
+{
+    size_t capacity = buffer->mask + 1;
+    uint64_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+    uint64_t start = head > capacity ? head - capacity : 0;
+    for (uint64_t i = start; i < head; i++)
+    {
+        copy[i - start] = buffer->events[i & buffer->mask];
+    }
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t head_after = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    // the slot of event head_after - capacity may be mid-write
+    uint64_t valid_start = head_after >= capacity ? head_after - capacity + 1 : 0;
+    if (valid_start <= start)
+    {
+        return head - start;
+    }
+    if (valid_start >= head)
+    {
+        return 0;
+    }
+    memmove(copy, copy + (valid_start - start), (head - valid_start) * sizeof(trace_event));
+    return head - valid_start;
+}
+
+/*
+ * jobs and idle time become duration slices, queue depth and pool size counter tracks,
+ * everything else instant events on the thread's timeline
+ */
+static void write_event_json(FILE *fp, const trace_event *event, pid_t pid, pid_t tid, double ts_us, bool *first)
+{
+    const char *separator = *first ? "" : ",\n";
+    *first = false;
+    switch (event->type)
+    {
+    case EventSubmit:
+    case EventPop:
+        fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"job\":\"0x%lx\",\"queue_depth\":%ld}}",
+                separator, event->type == EventSubmit ? "submit" : "pop", ts_us, pid, tid, event->arg, event->value);
+        fprintf(fp, ",\n{\"name\":\"queue_depth\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"args\":{\"jobs\":%ld}}",
+                ts_us, pid, event->value);
+        break;
+    case EventStart:
+        fprintf(fp, "%s{\"name\":\"job\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"f\":\"0x%lx\"}}",
+                separator, ts_us, pid, tid, event->arg);
+        break;
+    case EventEnd:
+        fprintf(fp, "%s{\"name\":\"job\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}", separator, ts_us, pid, tid);
+        break;
+    case EventPark:
+        fprintf(fp, "%s{\"name\":\"parked\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}", separator, ts_us, pid, tid);
+        break;
+    case EventWake:
+        fprintf(fp, "%s{\"name\":\"parked\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}", separator, ts_us, pid, tid);
+        break;
+    case EventClone:
+    case EventTerminate:
+        fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"pool_size\":%ld}}",
+                separator, event->type == EventClone ? "clone" : "terminate", ts_us, pid, tid, event->value);
+        fprintf(fp, ",\n{\"name\":\"pool_size\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"args\":{\"threads\":%ld}}",
+                ts_us, pid, event->value);
+        break;
+    case EventScalingAdvice:
+        fprintf(fp, "%s{\"name\":\"scaling_advice\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"diff\":%ld,\"advised\":%ld}}",
+                separator, ts_us, pid, tid, event->value, (long)(int64_t)event->arg);
+        break;
+    }
+}
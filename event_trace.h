@@ -0,0 +1,91 @@
+//
+// low overhead recorder of scheduler events, one single-writer ring buffer per thread
+// (oldest events are overwritten), dumped as Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+//
+
+#ifndef THREADPOOL_EVENT_TRACE_H
+#define THREADPOOL_EVENT_TRACE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef enum event_type
+{
+    // arg: job function, value: queue depth
+    EventSubmit,
+    // value: queue depth after the pop
+    EventPop,
+    // arg: job function
+    EventStart,
+    EventEnd,
+    // idle worker goes to sleep / wakes up again
+    EventPark,
+    EventWake,
+    // value: pool size after the scale job
+    EventClone,
+    EventTerminate,
+    // value: diff after the pool's limits, arg: the adapter's advice (int64_t), only recorded if either is not 0
+    EventScalingAdvice
+} event_type;
+
+typedef struct trace_event
+{
+    /** TSC (x86) or monotonic ns, converted when dumping */
+    uint64_t ticks;
+    uint64_t arg;
+    int64_t value;
+    event_type type;
+} trace_event;
+
+typedef struct event_buffer
+{
+    struct event_buffer *next;
+    pid_t tid;
+    char name[16];
+    /** capacity - 1, capacity is a power of two */
+    size_t mask;
+    /** events ever written, only the owning thread writes */
+    _Atomic uint64_t head;
+    trace_event events[];
+} event_buffer;
+
+typedef struct event_recorder
+{
+    /** unique per recorder, lets threads detect a stale cached buffer */
+    uint64_t id;
+    /** guards the buffer list */
+    pthread_mutex_t lock;
+    event_buffer *buffers;
+    size_t buffer_events;
+    uint64_t start_ticks;
+    uint64_t start_ns;
+} event_recorder;
+
+/**
+ * @param buffer_events: events kept per thread, rounded up to a power of two
+ * @return NULL if out of memory
+ */
+event_recorder *event_recorder_create(size_t buffer_events);
+
+/*
+ * all threads that recorded must be done recording
+ */
+void event_recorder_destroy(event_recorder *recorder);
+
+/*
+ * lock-free apart from the first event of each thread, which registers its buffer
+ * (named after the thread's name at that moment)
+ */
+void event_record(event_recorder *recorder, event_type type, uint64_t arg, int64_t value);
+
+/**
+ * may run while threads keep recording, events overwritten during the dump are left out
+ * @return false if the file can not be written
+ */
+bool event_recorder_dump_json(event_recorder *recorder, const char *path);
+
+#endif //THREADPOOL_EVENT_TRACE_H
@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "fiber.h"
+
+/* ==================== Prototypes ==================== */
+
+static fiber *take_fiber(fiber_pool *fp);
+
+static void prepare_context(fiber *fb, size_t stack_size, void (*entry)(void));
+
+static fiber *map_fiber(size_t stack_size);
+
+static size_t guard_size();
+
+/* ====================== API ====================== */
+
+bool fiber_pool_init(fiber_pool *fp, size_t stack_size)
+{
+    size_t page = guard_size();
+    // round up to whole pages, mprotect works on pages only
+    fp->stack_size = (stack_size + page - 1) / page * page;
+    fp->free = NULL;
+    return pthread_spin_init(&fp->lock, PTHREAD_PROCESS_PRIVATE) == 0;
+}
+
+void fiber_pool_destroy(fiber_pool *fp)
+{
+    pthread_spin_lock(&fp->lock);
+    fiber *to_free = fp->free;
+    fp->free = NULL;
+    pthread_spin_unlock(&fp->lock);
+    while (to_free != NULL)
+    {
+        fiber *next = to_free->next;
+        munmap(to_free->stack, guard_size() + fp->stack_size);
+        free(to_free);
+        to_free = next;
+    }
+    pthread_spin_destroy(&fp->lock);
+}
+
+fiber *fiber_acquire(fiber_pool *fp, void (*entry)(void), tfunc f, void *arg)
+{
+    fiber *fb = take_fiber(fp);
+    if (fb == NULL)
+    {
+        return NULL;
+    }
+    prepare_context(fb, fp->stack_size, entry);
+    fb->caller = NULL;
+    fb->f = f;
+    fb->arg = arg;
+    fb->state = FiberRunnable;
+    fb->await_fd = -1;
+    fb->await_events = 0;
+    fb->await_prev = NULL;
+    fb->await_next = NULL;
+    fb->allocations = NULL;
+    fb->next = NULL;
+    return fb;
+}
+
+void fiber_release(fiber_pool *fp, fiber *fb)
+{
+    while (fb->allocations != NULL)
+    {
+        fiber_allocation *next = fb->allocations->next;
+        free(fb->allocations);
+        fb->allocations = next;
+    }
+    pthread_spin_lock(&fp->lock);
+    fb->next = fp->free;
+    fp->free = fb;
+    pthread_spin_unlock(&fp->lock);
+}
+
+void *fiber_alloc(fiber *fb, size_t size, size_t alignment)
+{
+    fiber_allocation *block = malloc(sizeof(fiber_allocation) + alignment - 1 + size);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+    block->next = fb->allocations;
+    fb->allocations = block;
+    return (void *)(((uintptr_t)(block + 1) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+/* =================== Internal ===================== */
+
+static size_t guard_size()
+{
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * getcontext returns twice as far as the compiler knows, it gets a frame without locals that change
+ */
+static void prepare_context(fiber *fb, size_t stack_size, void (*entry)(void))
+{
+    getcontext(&fb->ctx);
+    fb->ctx.uc_stack.ss_sp = (char *)fb->stack + guard_size();
+    fb->ctx.uc_stack.ss_size = stack_size;
+    fb->ctx.uc_link = NULL;
+    makecontext(&fb->ctx, entry, 0);
+}
+
+/*
+ * a cached fiber, or a newly mapped one if the cache is empty
+ */
+static fiber *take_fiber(fiber_pool *fp)
+{
+    pthread_spin_lock(&fp->lock);
+    fiber *fb = fp->free;
+    if (fb != NULL)
+    {
+        fp->free = fb->next;
+    }
+    pthread_spin_unlock(&fp->lock);
+    return fb != NULL ? fb : map_fiber(fp->stack_size);
+}
+
+/*
+ * maps guard page + stack, the fiber struct itself is heap allocated
+ * (both are freed by fiber_pool_destroy)
+ */
+static fiber *map_fiber(size_t stack_size)
+{
+    fiber *fb = malloc(sizeof(fiber));
+    if (fb == NULL)
+    {
+        return NULL;
+    }
+    size_t guard = guard_size();
+    void *mapping = mmap(NULL, guard + stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        free(fb);
+        return NULL;
+    }
+    // stacks grow down, an overflow faults on the guard page instead of corrupting the heap
+    mprotect(mapping, guard, PROT_NONE);
+    fb->stack = mapping;
+    return fb;
+}
@@ -0,0 +1,81 @@
+//
+// stackful coroutines for fiber jobs, the pool decides when they run
+//
+
+#ifndef THREADPOOL_FIBER_H
+#define THREADPOOL_FIBER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ucontext.h>
+#include "adaptive_tpool.h"
+
+typedef enum fiber_state
+{
+    // created or resumable, waiting in the jobqueue
+    FiberRunnable,
+    // called tpool_yield, needs to be requeued
+    FiberYielded,
+    // called tpool_await_fd, needs to be registered with the poller
+    FiberAwaiting,
+    FiberFinished
+} fiber_state;
+
+typedef struct fiber_allocation
+{
+    struct fiber_allocation *next;
+} fiber_allocation;
+
+struct job;
+
+typedef struct fiber
+{
+    ucontext_t ctx;
+    /** context of the thread currently running the fiber, switched to on suspend */
+    ucontext_t *caller;
+    tfunc f;
+    void *arg;
+    fiber_state state;
+    int await_fd;
+    uint32_t await_events;
+    /** links of the pool's list of jobs awaiting an fd in the poller, guarded by the poller lock */
+    struct job *await_prev;
+    struct job *await_next;
+    /** tpool_arena_alloc memory of the fiber, it outlives suspends and is freed when the fiber is released */
+    fiber_allocation *allocations;
+    /** lowest address of the mapping, includes the guard page */
+    void *stack;
+    /** free list link while cached in the pool */
+    struct fiber *next;
+} fiber;
+
+typedef struct fiber_pool
+{
+    pthread_spinlock_t lock;
+    fiber *free;
+    size_t stack_size;
+} fiber_pool;
+
+bool fiber_pool_init(fiber_pool *fp, size_t stack_size);
+
+// unmaps all cached stacks, fibers still in use are leaked
+void fiber_pool_destroy(fiber_pool *fp);
+
+/**
+ * takes a cached fiber or maps a new stack, the fiber starts at entry once switched to
+ * @return NULL if no stack could be mapped
+ */
+fiber *fiber_acquire(fiber_pool *fp, void (*entry)(void), tfunc f, void *arg);
+
+// frees the fiber's allocations and returns its stack to the cache
+void fiber_release(fiber_pool *fp, fiber *fb);
+
+/**
+ * scratch memory that lives as long as the fiber, whichever worker resumes it
+ * @return NULL if malloc fails
+ */
+void *fiber_alloc(fiber *fb, size_t size, size_t alignment);
+
+#endif //THREADPOOL_FIBER_H
@@ -0,0 +1,57 @@
+#include <string.h>
+#include "interval_trace.h"
+
+/* ====================== API ====================== */
+
+void interval_trace_write_header(FILE *fp)
+{
+    fputs(INTERVAL_TRACE_HEADER, fp);
+}
+
+void interval_trace_write(FILE *fp, const IntervalDataFFI *data, size_t amount_syscalls,
+                          size_t num_threads, size_t num_busy_threads, size_t queue_depth)
+{
+    fprintf(fp, "%lu %lu %lu %lu %lu %zu %zu %zu %zu", data->start_ms, data->end_ms, data->read_bytes,
+            data->write_bytes, (unsigned long)data->amount_targets, num_threads, num_busy_threads, queue_depth,
+            amount_syscalls);
+    for (size_t i = 0; i < amount_syscalls; i++)
+    {
+        fprintf(fp, " %u:%lu", data->syscalls_data[i].count, data->syscalls_data[i].total_time);
+    }
+    fputc('\n', fp);
+}
+
+bool interval_trace_read_header(FILE *fp)
+{
+    char line[64];
+    return fgets(line, sizeof(line), fp) != NULL && strcmp(line, INTERVAL_TRACE_HEADER) == 0;
+}
+
+bool interval_trace_next(FILE *fp, interval_record *record)
+{
+    unsigned long amount_targets;
+    size_t amount_syscalls;
+    memset(record, 0, sizeof(interval_record));
+    if (fscanf(fp, "%lu %lu %lu %lu %lu %zu %zu %zu %zu", &record->data.start_ms, &record->data.end_ms,
+               &record->data.read_bytes, &record->data.write_bytes, &amount_targets, &record->num_threads,
+               &record->num_busy_threads, &record->queue_depth, &amount_syscalls) != 9)
+    {
+        return false;
+    }
+    record->data.amount_targets = amount_targets;
+    for (size_t i = 0; i < amount_syscalls; i++)
+    {
+        SyscallData syscall_data;
+        if (fscanf(fp, " %u:%lu", &syscall_data.count, &syscall_data.total_time) != 2)
+        {
+            return false;
+        }
+        if (i < INTERVAL_TRACE_MAX_SYSCALLS)
+        {
+            record->syscalls[i] = syscall_data;
+        }
+    }
+    record->amount_syscalls = amount_syscalls < INTERVAL_TRACE_MAX_SYSCALLS ? amount_syscalls : INTERVAL_TRACE_MAX_SYSCALLS;
+    record->data.syscalls_data = record->syscalls;
+    return true;
+}
@@ -0,0 +1,51 @@
+//
+// text log of the adapter's measurement intervals and the pool state at the time,
+// written by the benchmark and read by the simulator
+//
+// format: header line, then one line per interval:
+//   start_ms end_ms read_bytes write_bytes amount_targets num_threads num_busy queue_depth
+//   amount_syscalls, then <count>:<total_time> per tracked syscall
+//
+
+#ifndef THREADPOOL_INTERVAL_TRACE_H
+#define THREADPOOL_INTERVAL_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "adapter.h"
+
+#define INTERVAL_TRACE_HEADER "# tpool intervals v1\n"
+// syscalls past this many are dropped from a record
+#define INTERVAL_TRACE_MAX_SYSCALLS 16
+
+typedef struct interval_record
+{
+    /** syscalls_data points into syscalls */
+    IntervalDataFFI data;
+    SyscallData syscalls[INTERVAL_TRACE_MAX_SYSCALLS];
+    size_t amount_syscalls;
+    size_t num_threads;
+    size_t num_busy_threads;
+    size_t queue_depth;
+} interval_record;
+
+void interval_trace_write_header(FILE *fp);
+
+/**
+ * @param amount_syscalls: length of data->syscalls_data (the adapter's amount_syscalls)
+ */
+void interval_trace_write(FILE *fp, const IntervalDataFFI *data, size_t amount_syscalls,
+                          size_t num_threads, size_t num_busy_threads, size_t queue_depth);
+
+/**
+ * @return false if the header does not match
+ */
+bool interval_trace_read_header(FILE *fp);
+
+/**
+ * @return false at end of trace (or on a malformed line)
+ */
+bool interval_trace_next(FILE *fp, interval_record *record);
+
+#endif //THREADPOOL_INTERVAL_TRACE_H
@@ -0,0 +1,311 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "debug_macro.h"
+#include "pressure.h"
+
+/*
+ * psi: Documentation/accounting/psi.rst, cgroup files: Documentation/admin-guide/cgroup-v2.rst
+ * only totals are used, the kernel's avg10/60/300 lag behind a scaling interval
+ */
+
+/* ==================== Prototypes ==================== */
+
+static bool find_cgroup_dir(char *dir, size_t size);
+
+static bool sample_pressure(const char *cgroup_dir, tpool_pressure *pressure);
+
+static ssize_t read_small_file(const char *path, char *buffer, size_t size);
+
+static bool read_psi(const char *path, uint64_t *some_us, uint64_t *full_us);
+
+static void read_cpu_max(const char *path, double *quota);
+
+static void read_io_stat(const char *path, tpool_pressure *pressure);
+
+static uint64_t monotonic_us();
+
+/* ====================== API ====================== */
+
+bool tpool_sample_pressure(tpool_pressure *pressure)
+{
+    char cgroup_dir[256];
+    if (!find_cgroup_dir(cgroup_dir, sizeof(cgroup_dir)))
+    {
+        cgroup_dir[0] = '\0';
+    }
+    return sample_pressure(cgroup_dir, pressure);
+}
+
+pressure_governor *pressure_governor_create(const tpool_config *config)
+{
+    pressure_governor *governor = malloc(sizeof(pressure_governor));
+    if (governor == NULL)
+    {
+        return NULL;
+    }
+    if (!find_cgroup_dir(governor->cgroup_dir, sizeof(governor->cgroup_dir)))
+    {
+        governor->cgroup_dir[0] = '\0';
+    }
+    tpool_pressure probe;
+    // zero stall totals are normal on an idle system, only a missing psi interface means unavailable
+    bool psi = sample_pressure(governor->cgroup_dir, &probe);
+    if (!psi && probe.cpu_quota == 0)
+    {
+        debug_print("%s\n", "neither psi nor a cpu quota available, pressure is ignored");
+        free(governor);
+        return NULL;
+    }
+    pthread_mutex_init(&governor->lock, NULL);
+    // rates over a few microseconds are noise, and 0 would resample on every scaling decision
+    governor->interval_ms = config->pressure_interval_ms < PRESSURE_MIN_INTERVAL_MS ? PRESSURE_MIN_INTERVAL_MS
+                                                                                    : config->pressure_interval_ms;
+    governor->threads_per_cpu = config->quota_threads_per_cpu;
+    governor->io_pressure_max = config->io_pressure_max;
+    governor->memory_pressure_max = config->memory_pressure_max;
+    atomic_init(&governor->sampled_ms, 0);
+    governor->last_jobs = 0;
+    governor->last_threads = 0;
+    governor->last_io_stall = 0;
+    governor->last_jobs_rate = 0;
+    governor->last_io_rate = 0;
+    governor->io_cap = SIZE_MAX;
+    atomic_init(&governor->cap, SIZE_MAX);
+    return governor;
+}
+
+void pressure_governor_destroy(pressure_governor *governor)
+{
+    pthread_mutex_destroy(&governor->lock);
+    free(governor);
+}
+
+int pressure_governor_apply(pressure_governor *governor, size_t num_threads, uint64_t jobs_completed, int advice)
+{
+    uint64_t now_ms = monotonic_us() / 1000;
+    uint64_t sampled_ms = atomic_load_explicit(&governor->sampled_ms, memory_order_relaxed);
+    bool due = now_ms - sampled_ms >= governor->interval_ms;
+    if (!due || pthread_mutex_trylock(&governor->lock) != 0)
+    {
+        // between samples the cap only stops growth, a pool above it was already told to shrink
+        size_t cap = atomic_load_explicit(&governor->cap, memory_order_relaxed);
+        if (advice > 0 && num_threads + advice > cap)
+        {
+            return num_threads < cap ? (int)(cap - num_threads) : 0;
+        }
+        return advice;
+    }
+
+    tpool_pressure current;
+    sample_pressure(governor->cgroup_dir, &current);
+    size_t cap = governor->io_cap;
+    // two samples within the same microsecond have no rates, keep the last cap
+    if (sampled_ms != 0 && current.timestamp_us > governor->last.timestamp_us)
+    {
+        double elapsed_us = (double)(current.timestamp_us - governor->last.timestamp_us);
+        double io_stall = (current.io_some_us - governor->last.io_some_us) / elapsed_us;
+        double io_full_stall = (current.io_full_us - governor->last.io_full_us) / elapsed_us;
+        double memory_stall = (current.memory_some_us - governor->last.memory_some_us) / elapsed_us;
+        double jobs_rate = (jobs_completed - governor->last_jobs) * 1e6 / elapsed_us;
+        double io_rate = ((current.io_read_bytes + current.io_write_bytes) -
+                          (governor->last.io_read_bytes + governor->last.io_write_bytes)) * 1e6 / elapsed_us;
+
+        // the last growth step only made the device queue longer: go back and stay there
+        if (num_threads > governor->last_threads && io_stall > governor->last_io_stall + PRESSURE_STALL_RISE &&
+            jobs_rate <= governor->last_jobs_rate * PRESSURE_MIN_GAIN && io_rate <= governor->last_io_rate * PRESSURE_MIN_GAIN)
+        {
+            debug_print("growth to %zu threads only raised io stall to %.2f, capping at %zu\n",
+                        num_threads, io_stall, governor->last_threads);
+            governor->io_cap = governor->last_threads;
+        }
+        // pressure has eased, growth may be tried again
+        else if (io_stall < governor->io_pressure_max / 2)
+        {
+            governor->io_cap = SIZE_MAX;
+        }
+        cap = governor->io_cap;
+        if (io_full_stall >= governor->io_pressure_max || memory_stall >= governor->memory_pressure_max)
+        {
+            cap = cap < num_threads ? cap : num_threads;
+        }
+        governor->last_io_stall = io_stall;
+        governor->last_jobs_rate = jobs_rate;
+        governor->last_io_rate = io_rate;
+    }
+    if (current.cpu_quota > 0 && governor->threads_per_cpu > 0)
+    {
+        double quota_threads = current.cpu_quota * governor->threads_per_cpu;
+        size_t quota_cap = (size_t)quota_threads;
+        // rounded up, half a cpu of quota still runs a thread
+        if ((double)quota_cap < quota_threads)
+            quota_cap++;
+        cap = quota_cap < cap ? quota_cap : cap;
+    }
+    if (cap < 1)
+    {
+        cap = 1;
+    }
+    governor->last = current;
+    governor->last_jobs = jobs_completed;
+    governor->last_threads = num_threads;
+    atomic_store(&governor->cap, cap);
+    atomic_store(&governor->sampled_ms, now_ms);
+    pthread_mutex_unlock(&governor->lock);
+
+    long target = (long)num_threads + advice;
+    if (target > 0 && (size_t)target > cap)
+    {
+        target = cap;
+    }
+    return (int)(target - (long)num_threads);
+}
+
+/* =================== Internal ===================== */
+
+/*
+ * the "0::<path>" line of /proc/self/cgroup below the cgroup2 mount,
+ * /sys/fs/cgroup on unified hierarchies, /sys/fs/cgroup/unified on hybrid ones
+ */
+static bool find_cgroup_dir(char *dir, size_t size)
+{
+    const char *mount;
+    if (access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0)
+        mount = "/sys/fs/cgroup";
+    else if (access("/sys/fs/cgroup/unified/cgroup.controllers", F_OK) == 0)
+        mount = "/sys/fs/cgroup/unified";
+    else
+        return false;
+
+    char buffer[4096];
+    if (read_small_file("/proc/self/cgroup", buffer, sizeof(buffer)) <= 0)
+    {
+        return false;
+    }
+    char *line = strstr(buffer, "0::");
+    // the v2 entry may be preceded by v1 ones ("<id>:<controllers>:<path>")
+    while (line != NULL && line != buffer && line[-1] != '\n')
+    {
+        line = strstr(line + 1, "0::");
+    }
+    if (line == NULL)
+    {
+        return false;
+    }
+    line += 3;
+    line[strcspn(line, "\n")] = '\0';
+    return snprintf(dir, size, "%s%s", mount, line) < (int)size;
+}
+
+static bool sample_pressure(const char *cgroup_dir, tpool_pressure *pressure)
+{
+    char path[320];
+    uint64_t unused;
+    bool complete = true;
+
+    memset(pressure, 0, sizeof(tpool_pressure));
+    pressure->timestamp_us = monotonic_us();
+    complete &= read_psi("/proc/pressure/cpu", &pressure->cpu_some_us, &unused);
+    complete &= read_psi("/proc/pressure/io", &pressure->io_some_us, &pressure->io_full_us);
+    snprintf(path, sizeof(path), "%s/memory.pressure", cgroup_dir);
+    if (cgroup_dir[0] == '\0' || !read_psi(path, &pressure->memory_some_us, &pressure->memory_full_us))
+    {
+        complete &= read_psi("/proc/pressure/memory", &pressure->memory_some_us, &pressure->memory_full_us);
+    }
+    // controllers that are not enabled for the cgroup (always the case for the root) leave these at 0
+    if (cgroup_dir[0] != '\0')
+    {
+        snprintf(path, sizeof(path), "%s/cpu.max", cgroup_dir);
+        read_cpu_max(path, &pressure->cpu_quota);
+        snprintf(path, sizeof(path), "%s/io.stat", cgroup_dir);
+        read_io_stat(path, pressure);
+    }
+    return complete;
+}
+
+static ssize_t read_small_file(const char *path, char *buffer, size_t size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ssize_t length = read(fd, buffer, size - 1);
+    close(fd);
+    if (length < 0)
+    {
+        return -1;
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+/*
+ * some avg10=0.00 avg60=0.00 avg300=0.00 total=<us>
+ * full avg10=0.00 avg60=0.00 avg300=0.00 total=<us>   (missing for cpu before linux 5.13)
+ */
+static bool read_psi(const char *path, uint64_t *some_us, uint64_t *full_us)
+{
+    char buffer[256];
+    if (read_small_file(path, buffer, sizeof(buffer)) <= 0)
+    {
+        return false;
+    }
+    char *some = strstr(buffer, "some");
+    char *full = strstr(buffer, "full");
+    char *total;
+    if (some == NULL || (total = strstr(some, "total=")) == NULL)
+    {
+        return false;
+    }
+    *some_us = strtoull(total + 6, NULL, 10);
+    *full_us = full != NULL && (total = strstr(full, "total=")) != NULL ? strtoull(total + 6, NULL, 10) : 0;
+    return true;
+}
+
+/*
+ * "<quota> <period>" or "max <period>"
+ */
+static void read_cpu_max(const char *path, double *quota)
+{
+    char buffer[64];
+    unsigned long long max, period;
+    if (read_small_file(path, buffer, sizeof(buffer)) > 0 && sscanf(buffer, "%llu %llu", &max, &period) == 2 && period > 0)
+    {
+        *quota = (double)max / (double)period;
+    }
+}
+
+/*
+ * one line per device: <major>:<minor> rbytes=<n> wbytes=<n> rios=<n> wios=<n> dbytes=<n> dios=<n>
+ */
+static void read_io_stat(const char *path, tpool_pressure *pressure)
+{
+    char buffer[4096];
+    if (read_small_file(path, buffer, sizeof(buffer)) <= 0)
+    {
+        return;
+    }
+    char *saveptr = NULL;
+    for (char *line = strtok_r(buffer, "\n", &saveptr); line != NULL; line = strtok_r(NULL, "\n", &saveptr))
+    {
+        unsigned long long rbytes, wbytes, rios, wios;
+        if (sscanf(line, "%*u:%*u rbytes=%llu wbytes=%llu rios=%llu wios=%llu", &rbytes, &wbytes, &rios, &wios) == 4)
+        {
+            pressure->io_read_bytes += rbytes;
+            pressure->io_write_bytes += wbytes;
+            pressure->io_read_ops += rios;
+            pressure->io_write_ops += wios;
+        }
+    }
+}
+
+static uint64_t monotonic_us()
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t)spec.tv_sec * 1000000 + (uint64_t)spec.tv_nsec / 1000;
+}
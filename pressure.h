@@ -0,0 +1,62 @@
+//
+// scaling limits from pressure stall information (PSI) and the cgroup v2 cpu quota
+// sampled at most once per interval by whichever worker asks for scaling advice
+//
+
+#ifndef THREADPOOL_PRESSURE_H
+#define THREADPOOL_PRESSURE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "adaptive_tpool.h"
+
+// a growth step counts as unproductive if io stall rose by this share of time...
+#define PRESSURE_STALL_RISE 0.05
+// ...while neither jobs/s nor the cgroup's io bytes/s grew by this factor
+#define PRESSURE_MIN_GAIN 1.05
+// shorter pressure_interval_ms settings are raised to this
+#define PRESSURE_MIN_INTERVAL_MS 10
+
+typedef struct pressure_governor
+{
+    /** held by the sampling worker, the others use the cached cap meanwhile */
+    pthread_mutex_t lock;
+    /** cgroup v2 directory of the process, empty if there is none */
+    char cgroup_dir[256];
+    uint64_t interval_ms;
+    double threads_per_cpu;
+    double io_pressure_max;
+    double memory_pressure_max;
+    /** previous sample, valid once sampled_ms != 0 */
+    _Atomic uint64_t sampled_ms;
+    tpool_pressure last;
+    uint64_t last_jobs;
+    size_t last_threads;
+    double last_io_stall;
+    double last_jobs_rate;
+    double last_io_rate;
+    /** pool size before a growth step that only raised io stall, SIZE_MAX if none */
+    size_t io_cap;
+    /** limit of the last sample, SIZE_MAX if none */
+    _Atomic size_t cap;
+} pressure_governor;
+
+/**
+ * @return NULL if no pressure source is available at all
+ */
+pressure_governor *pressure_governor_create(const tpool_config *config);
+
+void pressure_governor_destroy(pressure_governor *governor);
+
+/**
+ * clamps the adapter's advice to the pressure limits, resamples if the interval passed
+ * may advise shrinking (at most once per interval) if the pool is above the limit
+ * @param jobs_completed: monotonically increasing job counter of the pool
+ * @return diff to scale by
+ */
+int pressure_governor_apply(pressure_governor *governor, size_t num_threads, uint64_t jobs_completed, int advice);
+
+#endif //THREADPOOL_PRESSURE_H
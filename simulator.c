@@ -0,0 +1,754 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "adapter.h"
+#include "interval_trace.h"
+
+/*
+ * offline replay of scaling algorithms against a throughput model built from benchmark results
+ * (benchmarking/analysis/throughput_model.py), there are no threads and no clock involved:
+ * the same model, parameters and seed always give the same result
+ *
+ * "adapter" replays the real algorithm of adapter.a: the simulated interval metrics are handed to it through
+ * the calc_interval_metrics hook in place of the traced ones, but the adapter closes intervals on its own clock,
+ * so every simulated interval takes one real adapter interval
+ * the surrogate models follow the adapter's idea in plain C and sweep thousands of combinations in seconds,
+ * their parameters are not the adapter's, confirm their best region with "adapter" before using it
+ */
+
+#define MODEL_HEADER "# tpool throughput model v1\n"
+#define MAX_MODEL_POINTS 256
+#define MAX_ALGO_PARAMS 8
+#define MAX_PARAM_STRING 256
+// a run whose model never finishes (throughput 0) is cut off after this much simulated time
+#define MAX_SIMULATED_MS (24 * 3600 * 1000UL)
+// the adapter must close an interval within this much real time, otherwise the replay is aborted
+#define ADAPTER_INTERVAL_TIMEOUT_MS 60000
+
+/**
+ * rates measured with a static pool of `threads` workers
+ * (the tracked syscall is the one the benchmark adapter traces: write)
+ */
+typedef struct model_point
+{
+    size_t threads;
+    double jobs_per_s;
+    double read_bytes_per_s;
+    double write_bytes_per_s;
+    double calls_per_s;
+    double call_time_ns_per_s;
+} model_point;
+
+typedef struct throughput_model
+{
+    model_point points[MAX_MODEL_POINTS];
+    /** sorted by thread count */
+    size_t amount;
+} throughput_model;
+
+typedef struct sim_settings
+{
+    double jobs;
+    uint64_t interval_ms;
+    /** relative amplitude of the uniform noise applied to each interval's rates, 0: none */
+    double noise;
+    uint64_t seed;
+} sim_settings;
+
+typedef struct sim_result
+{
+    double runtime_s;
+    double avg_threads;
+    size_t max_threads;
+    size_t scalings;
+    char params[MAX_PARAM_STRING];
+} sim_result;
+
+typedef struct sim_algorithm
+{
+    const char *name;
+    const char *params_doc;
+    /** own C model of an adapter algorithm, its parameters do not carry over to adapter_algo_params */
+    bool surrogate;
+    /** @return NULL for an invalid parameter string */
+    void *(*create)(const char *params);
+    /** @return amount of threads to add (negative: remove), like get_scaling_advice */
+    int (*advise)(void *state, IntervalDerivedData derived, size_t num_threads);
+    void (*destroy)(void *state);
+} sim_algorithm;
+
+typedef struct surrogate_hill_climb_state
+{
+    int step;
+    double min_gain;
+    double reset_change;
+    /** +1/-1 while exploring, 0 when settled */
+    int direction;
+    bool have_previous;
+    double previous_metric;
+    /** reset metric at the settled size, negative until the first interval after settling */
+    double settled_metric;
+} surrogate_hill_climb_state;
+
+typedef struct static_state
+{
+    size_t threads;
+} static_state;
+
+typedef struct adapter_state
+{
+    int32_t syscall_nrs[1];
+    AdapterParameters parameters;
+    pid_t tracee;
+} adapter_state;
+
+/* ==================== Prototypes ==================== */
+
+static bool load_model(const char *path, throughput_model *model);
+
+static void model_at(const throughput_model *model, size_t threads, model_point *rates);
+
+static IntervalDerivedData calc_metrics(const IntervalDataFFI *data);
+
+static bool simulate(const throughput_model *model, const sim_algorithm *algo, const char *params,
+                     const sim_settings *settings, sim_result *result);
+
+static size_t parse_param_grid(const char *grid, double lows[], double highs[], double steps[]);
+
+static int sweep(const throughput_model *model, const sim_algorithm *algo, const char *grid, const sim_settings *settings);
+
+static int check(const throughput_model *model, const char *trace_path);
+
+static const sim_algorithm *find_algorithm(const char *name);
+
+static double next_uniform(uint64_t *rng);
+
+static int compare_results(const void *a, const void *b);
+
+static size_t parse_params(const char *params, double values[], size_t max_values);
+
+static void *surrogate_hill_climb_create(const char *params);
+
+static int surrogate_hill_climb_advise(void *state, IntervalDerivedData derived, size_t num_threads);
+
+static void *static_create(const char *params);
+
+static int static_advise(void *state, IntervalDerivedData derived, size_t num_threads);
+
+static void *adapter_create(const char *params);
+
+static int adapter_advise(void *state, IntervalDerivedData derived, size_t num_threads);
+
+static void adapter_destroy(void *state);
+
+static IntervalDerivedData replayed_metrics(const IntervalDataFFI *data);
+
+static const sim_algorithm ALGORITHMS[] = {
+    {"adapter", "<adapter_algo_params>", false, adapter_create, adapter_advise, adapter_destroy},
+    {"surrogate_hill_climb", "<step>,<min_gain>,<reset_change>", true, surrogate_hill_climb_create,
+     surrogate_hill_climb_advise, free},
+    {"static", "<threads>", false, static_create, static_advise, free},
+};
+
+/* ==================== Globals ==================== */
+
+/** metrics of the simulated interval the adapter picks up with its next interval */
+static IntervalDerivedData replay_derived;
+static atomic_bool replay_pending;
+
+/* ====================== Main ====================== */
+
+int main(int argc, char **argv)
+{
+    throughput_model model;
+    if (argc < 4 || (strcmp(argv[2], "sweep") == 0 && argc < 5))
+    {
+        printf("args: <model> sweep <algorithm> <param_grid> [jobs] [interval_ms] [noise] [seed]\n");
+        printf("      <model> check <interval_trace>\n");
+        printf("--- model: written by benchmarking/analysis/throughput_model.py\n");
+        printf("--- param_grid: comma separated, per parameter either a value or <low>:<high>:<step>\n");
+        printf("--- jobs: default 100, interval_ms: default 1000, noise: default 0, seed: default 1\n");
+        printf("--- interval_trace: <METRICS_PREFIX>-intervals.txt of an adaptive benchmark run\n");
+        printf("valid algorithms:\n");
+        for (size_t i = 0; i < sizeof(ALGORITHMS) / sizeof(ALGORITHMS[0]); i++)
+        {
+            printf("--- %s %s%s\n", ALGORITHMS[i].name, ALGORITHMS[i].params_doc,
+                   ALGORITHMS[i].surrogate ? " (surrogate, parameters are not adapter_algo_params)" : "");
+        }
+        printf("--- adapter runs in real time (one adapter interval per simulated interval, set interval_ms to\n");
+        printf("    the adapter's), sweep a surrogate first and confirm its best region with it\n");
+        return -1;
+    }
+    if (!load_model(argv[1], &model))
+    {
+        printf("invalid model file %s\n", argv[1]);
+        return 1;
+    }
+    if (strcmp(argv[2], "check") == 0)
+    {
+        return check(&model, argv[3]);
+    }
+    if (strcmp(argv[2], "sweep") != 0)
+    {
+        printf("unknown mode %s\n", argv[2]);
+        return 1;
+    }
+    const sim_algorithm *algo = find_algorithm(argv[3]);
+    if (algo == NULL)
+    {
+        printf("unknown algorithm %s\n", argv[3]);
+        return 1;
+    }
+    sim_settings settings = {.jobs = 100, .interval_ms = 1000, .noise = 0, .seed = 1};
+    if (argc > 5)
+        settings.jobs = atof(argv[5]);
+    if (argc > 6)
+        settings.interval_ms = strtoull(argv[6], NULL, 10);
+    if (argc > 7)
+        settings.noise = atof(argv[7]);
+    if (argc > 8)
+        settings.seed = strtoull(argv[8], NULL, 10);
+    if (settings.jobs <= 0 || settings.interval_ms == 0)
+    {
+        printf("jobs and interval_ms must be positive\n");
+        return 1;
+    }
+    return sweep(&model, algo, argv[4], &settings);
+}
+
+/* =================== Model ===================== */
+
+/*
+ * header line, then per thread count:
+ * <threads> <jobs/s> <read bytes/s> <write bytes/s> <tracked syscalls/s> <tracked syscall ns/s>
+ */
+static bool load_model(const char *path, throughput_model *model)
+{
+    char line[256];
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    if (fgets(line, sizeof(line), fp) == NULL || strcmp(line, MODEL_HEADER) != 0)
+    {
+        fclose(fp);
+        return false;
+    }
+    model->amount = 0;
+    while (model->amount < MAX_MODEL_POINTS && fgets(line, sizeof(line), fp) != NULL)
+    {
+        model_point *point = &model->points[model->amount];
+        if (sscanf(line, "%zu %lf %lf %lf %lf %lf", &point->threads, &point->jobs_per_s, &point->read_bytes_per_s,
+                   &point->write_bytes_per_s, &point->calls_per_s, &point->call_time_ns_per_s) != 6)
+        {
+            continue;
+        }
+        // keep sorted, result files list thread counts in order so this rarely moves anything
+        size_t i = model->amount;
+        while (i > 0 && model->points[i - 1].threads > point->threads)
+        {
+            model_point tmp = model->points[i - 1];
+            model->points[i - 1] = model->points[i];
+            model->points[i] = tmp;
+            i--;
+        }
+        model->amount++;
+    }
+    fclose(fp);
+    return model->amount > 0;
+}
+
+/*
+ * linear interpolation between measured thread counts, 0 threads do no work,
+ * above the largest measured count the rates stay flat
+ */
+static void model_at(const throughput_model *model, size_t threads, model_point *rates)
+{
+    model_point lower = {0};
+    const model_point *upper = NULL;
+    for (size_t i = 0; i < model->amount; i++)
+    {
+        if (model->points[i].threads >= threads)
+        {
+            upper = &model->points[i];
+            break;
+        }
+        lower = model->points[i];
+    }
+    if (upper == NULL)
+    {
+        *rates = lower;
+        rates->threads = threads;
+        return;
+    }
+    double weight = upper->threads == lower.threads
+                        ? 1.0
+                        : (double)(threads - lower.threads) / (double)(upper->threads - lower.threads);
+    rates->threads = threads;
+    rates->jobs_per_s = lower.jobs_per_s + weight * (upper->jobs_per_s - lower.jobs_per_s);
+    rates->read_bytes_per_s = lower.read_bytes_per_s + weight * (upper->read_bytes_per_s - lower.read_bytes_per_s);
+    rates->write_bytes_per_s = lower.write_bytes_per_s + weight * (upper->write_bytes_per_s - lower.write_bytes_per_s);
+    rates->calls_per_s = lower.calls_per_s + weight * (upper->calls_per_s - lower.calls_per_s);
+    rates->call_time_ns_per_s = lower.call_time_ns_per_s + weight * (upper->call_time_ns_per_s - lower.call_time_ns_per_s);
+}
+
+/* =================== Simulation ===================== */
+
+/*
+ * same metric as calc_metrics in benchmark.c
+ */
+static IntervalDerivedData calc_metrics(const IntervalDataFFI *data)
+{
+    IntervalDerivedData derived;
+    derived.reset_metric = (double)data->write_bytes;
+    derived.scale_metric = (double)data->write_bytes;
+    return derived;
+}
+
+/*
+ * static load: all jobs are queued at the start, the pool starts with one worker like the adaptive benchmark pools
+ * @return false if the algorithm rejected the parameters
+ */
+static bool simulate(const throughput_model *model, const sim_algorithm *algo, const char *params,
+                     const sim_settings *settings, sim_result *result)
+{
+    void *state = algo->create(params);
+    if (state == NULL)
+    {
+        return false;
+    }
+    size_t max_threads = model->points[model->amount - 1].threads;
+    size_t threads = 1;
+    double remaining = settings->jobs;
+    double elapsed_ms = 0;
+    double thread_ms = 0;
+    uint64_t rng = settings->seed;
+    model_point rates;
+    SyscallData syscall_data;
+    IntervalDataFFI data = {.syscalls_data = &syscall_data};
+
+    memset(result, 0, sizeof(sim_result));
+    snprintf(result->params, sizeof(result->params), "%s", params);
+    result->max_threads = threads;
+    while (remaining > 0 && elapsed_ms < MAX_SIMULATED_MS)
+    {
+        // workers without a job do not add throughput
+        size_t active = (double)threads < ceil(remaining) ? threads : (size_t)ceil(remaining);
+        model_at(model, active, &rates);
+        double factor = settings->noise > 0 ? 1.0 + settings->noise * (2 * next_uniform(&rng) - 1) : 1.0;
+        double interval_s = (double)settings->interval_ms / 1000;
+        double done = rates.jobs_per_s * factor * interval_s;
+        if (done >= remaining)
+        {
+            // last interval ends with the last job
+            interval_s *= remaining / done;
+            done = remaining;
+        }
+        data.start_ms = (uint64_t)elapsed_ms;
+        data.end_ms = (uint64_t)(elapsed_ms + interval_s * 1000);
+        data.read_bytes = (uint64_t)(rates.read_bytes_per_s * factor * interval_s);
+        data.write_bytes = (uint64_t)(rates.write_bytes_per_s * factor * interval_s);
+        syscall_data.count = (uint32_t)(rates.calls_per_s * factor * interval_s);
+        syscall_data.total_time = (uint64_t)(rates.call_time_ns_per_s * factor * interval_s);
+        data.amount_targets = threads;
+
+        remaining -= done;
+        elapsed_ms += interval_s * 1000;
+        thread_ms += (double)threads * interval_s * 1000;
+        if (remaining <= 0)
+        {
+            break;
+        }
+        int to_scale = algo->advise(state, calc_metrics(&data), threads);
+        long scaled = (long)threads + to_scale;
+        size_t clamped = scaled < 1 ? 1 : ((size_t)scaled > max_threads ? max_threads : (size_t)scaled);
+        if (clamped != threads)
+        {
+            threads = clamped;
+            result->scalings++;
+            if (threads > result->max_threads)
+                result->max_threads = threads;
+        }
+    }
+    algo->destroy(state);
+    result->runtime_s = remaining > 0 ? INFINITY : elapsed_ms / 1000;
+    result->avg_threads = elapsed_ms > 0 ? thread_ms / elapsed_ms : (double)threads;
+    return true;
+}
+
+/*
+ * @return amount of parameters, 0 if the grid is malformed
+ */
+static size_t parse_param_grid(const char *grid, double lows[], double highs[], double steps[])
+{
+    size_t amount = 0;
+    const char *part = grid;
+    while (part != NULL && *part != '\0' && amount < MAX_ALGO_PARAMS)
+    {
+        int consumed = 0;
+        if (sscanf(part, "%lf:%lf:%lf%n", &lows[amount], &highs[amount], &steps[amount], &consumed) == 3)
+        {
+            if (steps[amount] <= 0 || highs[amount] < lows[amount])
+                return 0;
+        }
+        else if (sscanf(part, "%lf%n", &lows[amount], &consumed) == 1)
+        {
+            highs[amount] = lows[amount];
+            steps[amount] = 1;
+        }
+        else
+        {
+            return 0;
+        }
+        amount++;
+        part = strchr(part + consumed, ',');
+        if (part != NULL)
+            part++;
+    }
+    return amount;
+}
+
+/*
+ * simulates every combination of the grid, prints them sorted by runtime (fastest first)
+ */
+static int sweep(const throughput_model *model, const sim_algorithm *algo, const char *grid, const sim_settings *settings)
+{
+    double lows[MAX_ALGO_PARAMS], highs[MAX_ALGO_PARAMS], steps[MAX_ALGO_PARAMS];
+    size_t counters[MAX_ALGO_PARAMS] = {0};
+    size_t counts[MAX_ALGO_PARAMS];
+    size_t amount_params = parse_param_grid(grid, lows, highs, steps);
+    size_t combinations = 1;
+    if (amount_params == 0)
+    {
+        printf("invalid parameter grid %s\n", grid);
+        return 1;
+    }
+    for (size_t i = 0; i < amount_params; i++)
+    {
+        // small epsilon so 0.1:0.3:0.1 includes 0.3 despite rounding
+        counts[i] = (size_t)floor((highs[i] - lows[i]) / steps[i] + 1e-9) + 1;
+        combinations *= counts[i];
+    }
+    sim_result *results = malloc(combinations * sizeof(sim_result));
+    if (results == NULL)
+    {
+        printf("too many combinations: %zu\n", combinations);
+        return 1;
+    }
+    size_t amount_results = 0;
+    for (size_t c = 0; c < combinations; c++)
+    {
+        char params[MAX_PARAM_STRING];
+        size_t length = 0;
+        for (size_t i = 0; i < amount_params; i++)
+        {
+            length += snprintf(params + length, sizeof(params) - length, "%s%g", i == 0 ? "" : ",",
+                               lows[i] + (double)counters[i] * steps[i]);
+        }
+        if (!simulate(model, algo, params, settings, &results[amount_results]))
+        {
+            printf("algorithm %s rejected parameters %s\n", algo->name, params);
+            free(results);
+            return 1;
+        }
+        amount_results++;
+        // odometer over all parameters, last one changes fastest
+        for (size_t i = amount_params; i-- > 0;)
+        {
+            if (++counters[i] < counts[i])
+                break;
+            counters[i] = 0;
+        }
+    }
+    qsort(results, amount_results, sizeof(sim_result), compare_results);
+    if (algo->surrogate)
+        printf("# %s is a surrogate model, confirm the best parameters with the adapter algorithm\n", algo->name);
+    printf("runtime_s\tavg_threads\tmax_threads\tscalings\tparams\n");
+    for (size_t i = 0; i < amount_results; i++)
+    {
+        printf("%.3f\t%.2f\t%zu\t%zu\t%s\n", results[i].runtime_s, results[i].avg_threads, results[i].max_threads,
+               results[i].scalings, results[i].params);
+    }
+    free(results);
+    return 0;
+}
+
+/*
+ * compares recorded intervals with the model at the recorded amount of busy workers
+ */
+static int check(const throughput_model *model, const char *trace_path)
+{
+    interval_record record;
+    model_point rates;
+    double total_error = 0;
+    size_t compared = 0;
+    FILE *fp = fopen(trace_path, "r");
+    if (fp == NULL || !interval_trace_read_header(fp))
+    {
+        printf("invalid interval trace %s\n", trace_path);
+        if (fp != NULL)
+            fclose(fp);
+        return 1;
+    }
+    printf("start_ms\tthreads\tbusy\trecorded_write_Bps\tmodel_write_Bps\trel_error\n");
+    while (interval_trace_next(fp, &record))
+    {
+        if (record.data.end_ms <= record.data.start_ms)
+            continue;
+        double interval_s = (double)(record.data.end_ms - record.data.start_ms) / 1000;
+        double recorded = (double)record.data.write_bytes / interval_s;
+        model_at(model, record.num_busy_threads, &rates);
+        double error = recorded > 0 ? fabs(rates.write_bytes_per_s - recorded) / recorded : 0;
+        printf("%lu\t%zu\t%zu\t%.0f\t%.0f\t%.3f\n", record.data.start_ms, record.num_threads,
+               record.num_busy_threads, recorded, rates.write_bytes_per_s, error);
+        if (recorded > 0)
+        {
+            total_error += error;
+            compared++;
+        }
+    }
+    fclose(fp);
+    printf("mean relative error: %.3f (%zu intervals)\n", compared > 0 ? total_error / compared : 0, compared);
+    return 0;
+}
+
+/* =================== Helpers ===================== */
+
+static const sim_algorithm *find_algorithm(const char *name)
+{
+    for (size_t i = 0; i < sizeof(ALGORITHMS) / sizeof(ALGORITHMS[0]); i++)
+    {
+        if (strcmp(ALGORITHMS[i].name, name) == 0)
+            return &ALGORITHMS[i];
+    }
+    return NULL;
+}
+
+/*
+ * xorshift64*, in [0, 1)
+ */
+static double next_uniform(uint64_t *rng)
+{
+    if (*rng == 0)
+        *rng = 1;
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+    return (double)((*rng * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+}
+
+/*
+ * by runtime, ties broken by fewer threads on average (cheaper)
+ */
+static int compare_results(const void *a, const void *b)
+{
+    const sim_result *left = a;
+    const sim_result *right = b;
+    if (left->runtime_s != right->runtime_s)
+        return left->runtime_s < right->runtime_s ? -1 : 1;
+    if (left->avg_threads != right->avg_threads)
+        return left->avg_threads < right->avg_threads ? -1 : 1;
+    return 0;
+}
+
+/*
+ * @return amount of comma separated values parsed, stops at the first invalid one
+ */
+static size_t parse_params(const char *params, double values[], size_t max_values)
+{
+    size_t amount = 0;
+    while (params != NULL && amount < max_values)
+    {
+        char *end;
+        values[amount] = strtod(params, &end);
+        if (end == params)
+            break;
+        amount++;
+        params = *end == ',' ? end + 1 : NULL;
+    }
+    return amount;
+}
+
+/* =================== Algorithms ===================== */
+
+/*
+ * surrogate of the adapter's hill climbing, not its code:
+ * explores in one direction while the scale metric improves by at least min_gain (relative),
+ * steps back once it does not and settles there, a reset metric change of more than
+ * reset_change (relative) to the settled interval restarts exploring in the direction of the change
+ */
+static void *surrogate_hill_climb_create(const char *params)
+{
+    double values[3];
+    if (parse_params(params, values, 3) != 3 || values[0] < 1 || values[1] < 0 || values[2] < 0)
+    {
+        return NULL;
+    }
+    surrogate_hill_climb_state *state = malloc(sizeof(surrogate_hill_climb_state));
+    if (state == NULL)
+    {
+        return NULL;
+    }
+    state->step = (int)values[0];
+    state->min_gain = values[1];
+    state->reset_change = values[2];
+    state->direction = 1;
+    state->have_previous = false;
+    state->previous_metric = 0;
+    state->settled_metric = -1;
+    return state;
+}
+
+static int surrogate_hill_climb_advise(void *state_ptr, IntervalDerivedData derived, size_t num_threads)
+{
+    surrogate_hill_climb_state *state = state_ptr;
+    if (state->direction != 0)
+    {
+        if (!state->have_previous)
+        {
+            state->have_previous = true;
+            state->previous_metric = derived.scale_metric;
+            // can not shrink below one worker, explore upwards instead
+            if (state->direction < 0 && num_threads <= 1)
+                state->direction = 1;
+            return state->direction * state->step;
+        }
+        double base = state->previous_metric > 1 ? state->previous_metric : 1;
+        double gain = (derived.scale_metric - state->previous_metric) / base;
+        // removing workers is a gain if the metric does not drop by more than min_gain
+        bool keep_going = state->direction > 0 ? gain >= state->min_gain : gain > -state->min_gain;
+        state->previous_metric = derived.scale_metric;
+        if (keep_going && !(state->direction < 0 && num_threads <= 1))
+        {
+            return state->direction * state->step;
+        }
+        int undo = keep_going ? 0 : -state->direction * state->step;
+        state->direction = 0;
+        state->settled_metric = -1;
+        return undo;
+    }
+    if (state->settled_metric < 0)
+    {
+        state->settled_metric = derived.reset_metric;
+        return 0;
+    }
+    double base = state->settled_metric > 1 ? state->settled_metric : 1;
+    double change = (derived.reset_metric - state->settled_metric) / base;
+    if (fabs(change) > state->reset_change)
+    {
+        state->direction = change > 0 ? 1 : -1;
+        state->have_previous = false;
+        return surrogate_hill_climb_advise(state, derived, num_threads);
+    }
+    return 0;
+}
+
+/*
+ * baseline: jumps to a fixed size after the first interval
+ */
+static void *static_create(const char *params)
+{
+    double values[1];
+    if (parse_params(params, values, 1) != 1 || values[0] < 1)
+    {
+        return NULL;
+    }
+    static_state *state = malloc(sizeof(static_state));
+    if (state == NULL)
+    {
+        return NULL;
+    }
+    state->threads = (size_t)values[0];
+    return state;
+}
+
+static int static_advise(void *state_ptr, IntervalDerivedData derived, size_t num_threads)
+{
+    (void)derived;
+    static_state *state = state_ptr;
+    return (int)((long)state->threads - (long)num_threads);
+}
+
+/*
+ * the real algorithm of adapter.a, the simulator's thread is its only tracee:
+ * its own interval data is replaced by the simulated one in the metrics hook
+ * (an invalid parameter string makes new_adapter panic, like in the pool)
+ */
+static void *adapter_create(const char *params)
+{
+    adapter_state *state = malloc(sizeof(adapter_state));
+    if (state == NULL)
+    {
+        return NULL;
+    }
+    // the syscall the benchmark adapter tracks (write), its counts are replaced anyway
+    state->syscall_nrs[0] = 1;
+    state->parameters.syscall_nrs = state->syscall_nrs;
+    state->parameters.amount_syscalls = 1;
+    state->parameters.calc_interval_metrics = replayed_metrics;
+    state->tracee = (pid_t)syscall(__NR_gettid);
+    atomic_store(&replay_pending, false);
+    if (!new_adapter(&state->parameters, params) || !add_tracee(state->tracee))
+    {
+        close_adapter();
+        free(state);
+        return NULL;
+    }
+    return state;
+}
+
+/*
+ * hands the interval to the adapter and waits until it closed one of its own intervals with it
+ */
+static int adapter_advise(void *state_ptr, IntervalDerivedData derived, size_t num_threads)
+{
+    (void)state_ptr;
+    (void)num_threads;
+    replay_derived = derived;
+    atomic_store(&replay_pending, true);
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = 1000000};
+    for (unsigned waited_ms = 0; waited_ms < ADAPTER_INTERVAL_TIMEOUT_MS; waited_ms++)
+    {
+        int advice = get_scaling_advice();
+        if (!atomic_load(&replay_pending))
+        {
+            return advice;
+        }
+        nanosleep(&pause, NULL);
+    }
+    printf("adapter did not close an interval within %d ms\n", ADAPTER_INTERVAL_TIMEOUT_MS);
+    exit(1);
+}
+
+static void adapter_destroy(void *state_ptr)
+{
+    adapter_state *state = state_ptr;
+    remove_tracee(state->tracee);
+    close_adapter();
+    free(state);
+}
+
+/*
+ * calc_interval_metrics hook of the replayed adapter, ignores the traced data
+ */
+static IntervalDerivedData replayed_metrics(const IntervalDataFFI *data)
+{
+    (void)data;
+    // an interval the adapter closes without a new simulated one repeats the last
+    static IntervalDerivedData last;
+    if (atomic_load(&replay_pending))
+    {
+        last = replay_derived;
+        atomic_store(&replay_pending, false);
+    }
+    return last;
+}
@@ -0,0 +1,232 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "debug_macro.h"
+#include "thread_budget.h"
+
+#define THREAD_BUDGET_MAGIC 0x7470626475763031ULL
+// workers check the advice between every job, the segment is only scanned this often unless growing
+#define THREAD_BUDGET_PUBLISH_MS 10
+
+_Static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "segment atomics must be lock free to work across processes");
+
+/* ==================== Prototypes ==================== */
+
+static bool claim_slot(thread_budget *budget, uint64_t now_ms);
+
+static bool slot_active(thread_budget *budget, size_t slot, uint64_t now_ms);
+
+static uint64_t monotonic_ms();
+
+/* ==================== Globals ==================== */
+
+/** distinguishes pools of the same process */
+static _Atomic uint32_t next_serial = 1;
+
+/* ====================== API ====================== */
+
+thread_budget *thread_budget_join(const char *name, size_t budget_threads)
+{
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+    {
+        debug_print("could not open budget segment %s\n", name);
+        return NULL;
+    }
+    struct stat info;
+    // concurrent creators extend to the same size, new pages are zero: a free slot and no magic yet
+    if (fstat(fd, &info) != 0 || ((size_t)info.st_size < sizeof(thread_budget_segment) &&
+                                  ftruncate(fd, sizeof(thread_budget_segment)) != 0))
+    {
+        close(fd);
+        return NULL;
+    }
+    thread_budget_segment *segment = mmap(NULL, sizeof(thread_budget_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED)
+    {
+        return NULL;
+    }
+    uint64_t magic = 0;
+    if (!atomic_compare_exchange_strong(&segment->magic, &magic, THREAD_BUDGET_MAGIC) && magic != THREAD_BUDGET_MAGIC)
+    {
+        debug_print("budget segment %s has an incompatible layout\n", name);
+        munmap(segment, sizeof(thread_budget_segment));
+        return NULL;
+    }
+
+    thread_budget *budget = malloc(sizeof(thread_budget));
+    if (budget == NULL)
+    {
+        munmap(segment, sizeof(thread_budget_segment));
+        return NULL;
+    }
+    budget->segment = segment;
+    budget->slot = 0;
+    budget->owner = ((uint64_t)getpid() << 32) | atomic_fetch_add(&next_serial, 1);
+    pthread_mutex_init(&budget->lock, NULL);
+    uint64_t now = monotonic_ms();
+    budget->window_start_ms = now;
+    budget->window_start_jobs = 0;
+    budget->last_shrink_ms = 0;
+    memset(budget->checked_owner, 0, sizeof(budget->checked_owner));
+    budget->liveness_ms = now;
+
+    if (budget_threads > 0)
+    {
+        // the first participant sets the budget, it is only replaced once all of them are gone
+        bool alone = true;
+        for (size_t i = 0; i < THREAD_BUDGET_SLOTS; i++)
+        {
+            alone = alone && !slot_active(budget, i, now);
+        }
+        uint64_t expected = 0;
+        if (alone)
+            atomic_store(&segment->budget, budget_threads);
+        else
+            atomic_compare_exchange_strong(&segment->budget, &expected, budget_threads);
+    }
+    atomic_init(&budget->allowed, atomic_load(&segment->budget));
+    if (atomic_load(&segment->budget) == 0 || !claim_slot(budget, now))
+    {
+        debug_print("budget segment %s has no budget or no free slot\n", name);
+        thread_budget_leave(budget);
+        return NULL;
+    }
+    return budget;
+}
+
+void thread_budget_leave(thread_budget *budget)
+{
+    uint64_t owner = budget->owner;
+    atomic_compare_exchange_strong(&budget->segment->slots[budget->slot].owner, &owner, 0);
+    munmap(budget->segment, sizeof(thread_budget_segment));
+    pthread_mutex_destroy(&budget->lock);
+    free(budget);
+}
+
+int thread_budget_apply(thread_budget *budget, size_t num_threads, uint64_t jobs_completed, int advice)
+{
+    thread_budget_slot *own = &budget->segment->slots[budget->slot];
+    uint64_t now = monotonic_ms();
+    // shrinking or staying never exceeds the budget, publishing it can wait
+    if (advice <= 0 && now - atomic_load_explicit(&own->heartbeat_ms, memory_order_relaxed) < THREAD_BUDGET_PUBLISH_MS &&
+        num_threads <= atomic_load_explicit(&budget->allowed, memory_order_relaxed))
+    {
+        return advice;
+    }
+
+    pthread_mutex_lock(&budget->lock);
+    atomic_store(&own->heartbeat_ms, now);
+    if (now - budget->window_start_ms >= 1000)
+    {
+        atomic_store(&own->jobs_per_s, (jobs_completed - budget->window_start_jobs) * 1000 / (now - budget->window_start_ms));
+        budget->window_start_ms = now;
+        budget->window_start_jobs = jobs_completed;
+    }
+
+    size_t others = 0;
+    size_t active = 1;
+    for (size_t i = 0; i < THREAD_BUDGET_SLOTS; i++)
+    {
+        thread_budget_slot *slot = &budget->segment->slots[i];
+        if (i != budget->slot && slot_active(budget, i, now))
+        {
+            others += atomic_load(&slot->num_threads);
+            active++;
+        }
+    }
+    size_t total = atomic_load(&budget->segment->budget);
+    size_t fair_share = total / active;
+    size_t allowed = total > others && total - others > fair_share ? total - others : fair_share;
+    if (allowed < 1)
+    {
+        allowed = 1;
+    }
+    atomic_store(&budget->allowed, allowed);
+
+    // above the share: grow no further, shrink once per rebalance interval
+    size_t cap = num_threads > allowed ? num_threads : allowed;
+    if (num_threads > allowed && now - budget->last_shrink_ms >= THREAD_BUDGET_REBALANCE_MS)
+    {
+        cap = allowed;
+        budget->last_shrink_ms = now;
+    }
+    long target = (long)num_threads + advice;
+    if (target > (long)cap)
+    {
+        debug_print("budget clamps scaling to %zu threads (advised %ld)\n", cap, target);
+        target = cap;
+    }
+    // the target, not the current size: clone jobs take a while and must not be granted twice
+    atomic_store(&own->num_threads, target);
+    pthread_mutex_unlock(&budget->lock);
+    return (int)(target - (long)num_threads);
+}
+
+/* =================== Internal ===================== */
+
+/*
+ * takes the first free slot or one of an exited process, a racing claimer loses the CAS and tries the next one
+ */
+static bool claim_slot(thread_budget *budget, uint64_t now_ms)
+{
+    for (size_t i = 0; i < THREAD_BUDGET_SLOTS; i++)
+    {
+        thread_budget_slot *slot = &budget->segment->slots[i];
+        uint64_t owner = atomic_load(&slot->owner);
+        if (owner != 0 && slot_active(budget, i, now_ms))
+        {
+            continue;
+        }
+        if (atomic_compare_exchange_strong(&slot->owner, &owner, budget->owner))
+        {
+            atomic_store(&slot->num_threads, 0);
+            atomic_store(&slot->jobs_per_s, 0);
+            atomic_store(&slot->heartbeat_ms, now_ms);
+            budget->slot = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * a slot stays taken as long as its owner process exists, however long its jobs run:
+ * the heartbeat is only written while scaling, it can not tell a busy pool from a dead one
+ * owners are probed once per rebalance interval, not on every apply of the worker loop
+ */
+static bool slot_active(thread_budget *budget, size_t slot, uint64_t now_ms)
+{
+    uint64_t owner = atomic_load(&budget->segment->slots[slot].owner);
+    if (owner == 0)
+    {
+        return false;
+    }
+    if (now_ms - budget->liveness_ms >= THREAD_BUDGET_REBALANCE_MS)
+    {
+        memset(budget->checked_owner, 0, sizeof(budget->checked_owner));
+        budget->liveness_ms = now_ms;
+    }
+    if (budget->checked_owner[slot] != owner)
+    {
+        // EPERM: the process exists but belongs to another user
+        budget->checked_owner[slot] = owner;
+        budget->owner_alive[slot] = kill((pid_t)(owner >> 32), 0) == 0 || errno == EPERM;
+    }
+    return budget->owner_alive[slot];
+}
+
+static uint64_t monotonic_ms()
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t)spec.tv_sec * 1000 + (uint64_t)spec.tv_nsec / 1000000;
+}
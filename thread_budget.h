@@ -0,0 +1,86 @@
+//
+// cross-process thread budget for adaptive pools sharing a device
+// every participating pool owns a slot in a named shared memory segment (shm_open) and publishes
+// its thread count and throughput there, scaling advice is clamped to the pool's share of the budget
+//
+// share of a pool: max(budget / active pools, budget - threads of the other pools)
+// so an idle budget can be used by anyone, but every pool can always grow to its fair share
+//
+// slots of processes that exited without leaving are reused, the owner pid is checked with kill(pid, 0)
+// (participants must share a pid namespace), at most once per rebalance interval
+//
+// the segment is created with mode 0600: only processes of the same user can join, a writable segment
+// would let anyone rewrite the budget and the other pools' slots
+//
+
+#ifndef THREADPOOL_THREAD_BUDGET_H
+#define THREADPOOL_THREAD_BUDGET_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define THREAD_BUDGET_SLOTS 64
+// over-budget pools shrink at most this often, pending terminate jobs are not visible in the counts
+#define THREAD_BUDGET_REBALANCE_MS 500
+
+typedef struct thread_budget_slot
+{
+    /** (pid << 32) | pool serial of the owner, 0 if free */
+    _Alignas(64) _Atomic uint64_t owner;
+    /** CLOCK_MONOTONIC of the last publish, only paces the owner's own publishing */
+    _Atomic uint64_t heartbeat_ms;
+    _Atomic uint64_t num_threads;
+    /** jobs completed per second over the last publish window */
+    _Atomic uint64_t jobs_per_s;
+} thread_budget_slot;
+
+typedef struct thread_budget_segment
+{
+    _Atomic uint64_t magic;
+    /** set by the first pool that joins with a budget */
+    _Atomic uint64_t budget;
+    thread_budget_slot slots[THREAD_BUDGET_SLOTS];
+} thread_budget_segment;
+
+// process-local handle of a joined pool
+typedef struct thread_budget
+{
+    thread_budget_segment *segment;
+    size_t slot;
+    uint64_t owner;
+    /** serializes apply calls of the pool's workers */
+    pthread_mutex_t lock;
+    uint64_t window_start_ms;
+    uint64_t window_start_jobs;
+    uint64_t last_shrink_ms;
+    /** kill(pid, 0) results per slot, valid for the owner they were checked for until liveness_ms is stale */
+    uint64_t checked_owner[THREAD_BUDGET_SLOTS];
+    bool owner_alive[THREAD_BUDGET_SLOTS];
+    uint64_t liveness_ms;
+    /** share computed by the last apply call */
+    _Atomic size_t allowed;
+} thread_budget;
+
+/**
+ * maps (creating if needed) the segment and claims a slot
+ * @param name: shm_open name, e.g. "/tpool-nvme0"
+ * @param budget: total threads of all participants, 0 to use the budget of the segment
+ * @return NULL if the segment can not be mapped, is incompatible, has no budget or no free slot
+ */
+thread_budget *thread_budget_join(const char *name, size_t budget);
+
+// frees the slot, the segment itself stays for the other participants
+void thread_budget_leave(thread_budget *budget);
+
+/**
+ * publishes the pool's state and clamps the adapter's advice to the pool's share
+ * may advise shrinking even if the adapter did not
+ * @param jobs_completed: monotonically increasing job counter of the pool
+ * @return diff to scale by
+ */
+int thread_budget_apply(thread_budget *budget, size_t num_threads, uint64_t jobs_completed, int advice);
+
+#endif //THREADPOOL_THREAD_BUDGET_H
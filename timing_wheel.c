@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include "timing_wheel.h"
+
+#define TW_SLOT_MASK (TW_SLOTS - 1)
+// first delta that does not fit into the wheel anymore
+#define TW_RANGE ((uint64_t)1 << (TW_LEVELS * TW_SLOT_BITS))
+
+/* ==================== Prototypes ==================== */
+
+static bool grow_nodes(timing_wheel *tw);
+
+static void link_timer(timing_wheel *tw, uint32_t index);
+
+static void unlink_timer(timing_wheel *tw, uint32_t index);
+
+static void release_node(timing_wheel *tw, uint32_t index);
+
+static void cascade(timing_wheel *tw, int level);
+
+/* ====================== API ====================== */
+
+bool tw_init(timing_wheel *tw, uint64_t now_ms)
+{
+    tw->current_ms = now_ms;
+    for (int i = 0; i < TW_LEVELS * TW_SLOTS; i++)
+    {
+        tw->heads[i] = TW_NIL;
+    }
+    tw->nodes = NULL;
+    tw->capacity = 0;
+    tw->free_head = TW_NIL;
+    tw->active = 0;
+    return grow_nodes(tw);
+}
+
+void tw_free(timing_wheel *tw)
+{
+    free(tw->nodes);
+    tw->nodes = NULL;
+    tw->capacity = 0;
+    tw->free_head = TW_NIL;
+    tw->active = 0;
+}
+
+uint64_t tw_insert(timing_wheel *tw, uint64_t now_ms, uint64_t delay_ms, uint64_t period_ms, tfunc f, void *arg)
+{
+    // an empty wheel may have stopped ticking, nothing linked so it is safe to jump ahead
+    if (tw->active == 0 && now_ms > tw->current_ms)
+    {
+        tw->current_ms = now_ms;
+    }
+    if (tw->free_head == TW_NIL && !grow_nodes(tw))
+    {
+        return 0;
+    }
+    uint32_t index = tw->free_head;
+    tw_timer *t = &tw->nodes[index];
+    tw->free_head = t->next;
+
+    t->expiry_ms = now_ms + delay_ms;
+    t->period_ms = period_ms;
+    t->f = f;
+    t->arg = arg;
+    link_timer(tw, index);
+    tw->active += 1;
+    return ((uint64_t)t->generation << 32) | index;
+}
+
+bool tw_cancel(timing_wheel *tw, uint64_t id)
+{
+    uint32_t index = (uint32_t)id;
+    uint32_t generation = (uint32_t)(id >> 32);
+    if (index >= tw->capacity)
+    {
+        return false;
+    }
+    tw_timer *t = &tw->nodes[index];
+    if (t->generation != generation || t->slot == TW_NIL)
+    {
+        return false;
+    }
+    unlink_timer(tw, index);
+    release_node(tw, index);
+    return true;
+}
+
+uint64_t tw_next_deadline(const timing_wheel *tw)
+{
+    uint64_t tick = tw->current_ms;
+    // stop at the next wrap, upper levels cascade there (including a pending wrap at current_ms)
+    while ((tick & TW_SLOT_MASK) != 0 && tw->heads[tick & TW_SLOT_MASK] == TW_NIL)
+    {
+        tick++;
+    }
+    return tick;
+}
+
+size_t tw_advance(timing_wheel *tw, uint64_t now_ms, tw_expire_fn on_expire, void *ctx)
+{
+    size_t expired = 0;
+    while (tw->current_ms <= now_ms)
+    {
+        // when a level wraps around, pull the next slot of the level above down
+        for (int level = 1; level < TW_LEVELS; level++)
+        {
+            if (((tw->current_ms >> ((level - 1) * TW_SLOT_BITS)) & TW_SLOT_MASK) != 0)
+            {
+                break;
+            }
+            cascade(tw, level);
+        }
+        // detach the whole slot first, periodic timers may be re-linked into it
+        uint32_t slot = tw->current_ms & TW_SLOT_MASK;
+        uint32_t index = tw->heads[slot];
+        tw->heads[slot] = TW_NIL;
+        while (index != TW_NIL)
+        {
+            tw_timer *t = &tw->nodes[index];
+            uint32_t next = t->next;
+            t->slot = TW_NIL;
+            on_expire(t->f, t->arg, ctx);
+            expired++;
+            if (t->period_ms > 0)
+            {
+                t->expiry_ms += t->period_ms;
+                // missed periods (late timer thread) are coalesced into the next tick
+                if (t->expiry_ms <= tw->current_ms)
+                {
+                    t->expiry_ms = tw->current_ms + 1;
+                }
+                link_timer(tw, index);
+            }
+            else
+            {
+                release_node(tw, index);
+            }
+            index = next;
+        }
+        tw->current_ms++;
+    }
+    return expired;
+}
+
+/* =================== Internal ===================== */
+
+/*
+ * doubles the node array and threads the new nodes onto the free list
+ */
+static bool grow_nodes(timing_wheel *tw)
+{
+    uint32_t new_capacity = tw->capacity == 0 ? 64 : tw->capacity * 2;
+    tw_timer *nodes = realloc(tw->nodes, new_capacity * sizeof(tw_timer));
+    if (nodes == NULL)
+    {
+        return false;
+    }
+    for (uint32_t i = tw->capacity; i < new_capacity; i++)
+    {
+        nodes[i].generation = 1;
+        nodes[i].slot = TW_NIL;
+        nodes[i].next = i + 1 < new_capacity ? i + 1 : tw->free_head;
+    }
+    tw->free_head = tw->capacity;
+    tw->nodes = nodes;
+    tw->capacity = new_capacity;
+    return true;
+}
+
+/*
+ * picks the level by distance to expiry and pushes the timer to the slot head
+ */
+static void link_timer(timing_wheel *tw, uint32_t index)
+{
+    tw_timer *t = &tw->nodes[index];
+    uint64_t expiry = t->expiry_ms < tw->current_ms ? tw->current_ms : t->expiry_ms;
+    uint64_t delta = expiry - tw->current_ms;
+    if (delta >= TW_RANGE)
+    {
+        // park in the furthest slot, gets re-cascaded until it fits
+        expiry = tw->current_ms + TW_RANGE - 1;
+        delta = TW_RANGE - 1;
+    }
+    int level = 0;
+    while (delta >= ((uint64_t)1 << ((level + 1) * TW_SLOT_BITS)))
+    {
+        level++;
+    }
+    uint32_t slot = level * TW_SLOTS + ((expiry >> (level * TW_SLOT_BITS)) & TW_SLOT_MASK);
+    t->slot = slot;
+    t->prev = TW_NIL;
+    t->next = tw->heads[slot];
+    if (t->next != TW_NIL)
+    {
+        tw->nodes[t->next].prev = index;
+    }
+    tw->heads[slot] = index;
+}
+
+static void unlink_timer(timing_wheel *tw, uint32_t index)
+{
+    tw_timer *t = &tw->nodes[index];
+    if (t->prev != TW_NIL)
+    {
+        tw->nodes[t->prev].next = t->next;
+    }
+    else
+    {
+        tw->heads[t->slot] = t->next;
+    }
+    if (t->next != TW_NIL)
+    {
+        tw->nodes[t->next].prev = t->prev;
+    }
+    t->slot = TW_NIL;
+}
+
+static void release_node(timing_wheel *tw, uint32_t index)
+{
+    tw_timer *t = &tw->nodes[index];
+    t->generation = t->generation == UINT32_MAX ? 1 : t->generation + 1;
+    t->next = tw->free_head;
+    tw->free_head = index;
+    tw->active -= 1;
+}
+
+/*
+ * re-inserts all timers of the level's current slot relative to current_ms
+ */
+static void cascade(timing_wheel *tw, int level)
+{
+    uint32_t slot = level * TW_SLOTS + ((tw->current_ms >> (level * TW_SLOT_BITS)) & TW_SLOT_MASK);
+    uint32_t index = tw->heads[slot];
+    tw->heads[slot] = TW_NIL;
+    while (index != TW_NIL)
+    {
+        uint32_t next = tw->nodes[index].next;
+        link_timer(tw, index);
+        index = next;
+    }
+}
@@ -0,0 +1,80 @@
+//
+// hierarchical timing wheel used by the pool's timer thread
+// (not thread safe, the pool serializes access with its timer lock)
+//
+
+#ifndef THREADPOOL_TIMING_WHEEL_H
+#define THREADPOOL_TIMING_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "adaptive_tpool.h"
+
+// 4 levels of 64 slots with 1ms ticks cover ~4.6 hours,
+// timers further out are parked in the last level and re-cascaded
+#define TW_LEVELS 4
+#define TW_SLOT_BITS 6
+#define TW_SLOTS (1 << TW_SLOT_BITS)
+#define TW_NIL UINT32_MAX
+
+typedef struct tw_timer
+{
+    uint64_t expiry_ms;
+    /** 0 for one-shot timers */
+    uint64_t period_ms;
+    tfunc f;
+    void *arg;
+    /** bumped whenever the node is freed, makes stale ids detectable */
+    uint32_t generation;
+    /** index of the slot list the timer is linked into, TW_NIL if unlinked */
+    uint32_t slot;
+    uint32_t prev;
+    uint32_t next;
+} tw_timer;
+
+typedef struct timing_wheel
+{
+    /** next tick that has not been processed yet */
+    uint64_t current_ms;
+    uint32_t heads[TW_LEVELS * TW_SLOTS];
+    /** node storage, links are indices so the array can grow */
+    tw_timer *nodes;
+    uint32_t capacity;
+    uint32_t free_head;
+    size_t active;
+} timing_wheel;
+
+/** called for every expired timer, periodic timers are re-armed afterwards */
+typedef void (*tw_expire_fn)(tfunc f, void *arg, void *ctx);
+
+bool tw_init(timing_wheel *tw, uint64_t now_ms);
+
+void tw_free(timing_wheel *tw);
+
+/**
+ * arms a timer that expires delay_ms after now_ms
+ * @return timer id (generation << 32 | index), 0 if out of memory
+ */
+uint64_t tw_insert(timing_wheel *tw, uint64_t now_ms, uint64_t delay_ms, uint64_t period_ms, tfunc f, void *arg);
+
+/**
+ * unlinks the timer in O(1)
+ * @return false if the id is stale (one-shot already fired or cancelled)
+ */
+bool tw_cancel(timing_wheel *tw, uint64_t id);
+
+/**
+ * earliest tick that needs processing: the next occupied level 0 slot,
+ * or the next wrap of level 0 at which upper levels cascade
+ * only meaningful while timers are active
+ */
+uint64_t tw_next_deadline(const timing_wheel *tw);
+
+/**
+ * processes all ticks up to and including now_ms
+ * @return amount of expired timers
+ */
+size_t tw_advance(timing_wheel *tw, uint64_t now_ms, tw_expire_fn on_expire, void *ctx);
+
+#endif //THREADPOOL_TIMING_WHEEL_H
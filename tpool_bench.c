@@ -0,0 +1,466 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+
+#include "adaptive_tpool.h"
+
+/*
+ * scheduler overhead microbenchmarks, all jobs are (nearly) empty so only pool costs are measured
+ * output: json list in the format of benchmarking/raw_results_to_json.py
+ * (workload, thread_config, runtime_s, avg_latency_ms, ...) plus a "metrics" map per run
+ */
+
+#define MAX_RESULTS 256
+
+typedef struct bench_result
+{
+    char workload[64];
+    size_t num_workers;
+    size_t num_producers;
+    double runtime_s;
+    double avg_latency_ms;
+    /** -1 if the benchmark does not measure latency distributions */
+    double p50_us;
+    double p99_us;
+    double p999_us;
+    double jobs_per_s;
+} bench_result;
+
+typedef struct latency_sample
+{
+    uint64_t submit_ns;
+    uint64_t *start_delta_ns;
+} latency_sample;
+
+typedef struct producer_args
+{
+    threadpool tp;
+    size_t jobs;
+} producer_args;
+
+bench_result results[MAX_RESULTS];
+size_t num_results = 0;
+atomic_size_t jobs_done;
+atomic_uint_fast64_t last_end_ns;
+
+uint64_t now_ns()
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t)spec.tv_sec * 1000000000 + (uint64_t)spec.tv_nsec;
+}
+
+void sleep_ms(uint64_t ms)
+{
+    struct timespec spec = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000};
+    nanosleep(&spec, NULL);
+}
+
+bench_result *new_result(const char *workload, size_t num_workers, size_t num_producers)
+{
+    if (num_results == MAX_RESULTS)
+    {
+        fprintf(stderr, "too many results, increase MAX_RESULTS\n");
+        exit(1);
+    }
+    bench_result *result = &results[num_results++];
+    snprintf(result->workload, sizeof(result->workload), "tpool_bench-%s", workload);
+    result->num_workers = num_workers;
+    result->num_producers = num_producers;
+    result->runtime_s = 0;
+    result->avg_latency_ms = -1;
+    result->p50_us = -1;
+    result->p99_us = -1;
+    result->p999_us = -1;
+    result->jobs_per_s = -1;
+    return result;
+}
+
+int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * sorts samples and stores average and percentiles in result
+ */
+void fill_latencies(bench_result *result, uint64_t *samples_ns, size_t amount)
+{
+    qsort(samples_ns, amount, sizeof(uint64_t), cmp_u64);
+    double sum = 0;
+    for (size_t i = 0; i < amount; i++)
+    {
+        sum += (double)samples_ns[i];
+    }
+    result->avg_latency_ms = sum / amount / 1e6;
+    result->p50_us = samples_ns[(amount * 500) / 1000] / 1e3;
+    result->p99_us = samples_ns[(amount * 990) / 1000] / 1e3;
+    result->p999_us = samples_ns[(amount * 999) / 1000] / 1e3;
+}
+
+void wait_for_jobs(size_t amount)
+{
+    while (atomic_load(&jobs_done) < amount)
+    {
+        sched_yield();
+    }
+}
+
+void empty_job(void *arg)
+{
+    (void)arg;
+    atomic_fetch_add(&jobs_done, 1);
+}
+
+void latency_job(void *arg)
+{
+    latency_sample *sample = arg;
+    *sample->start_delta_ns = now_ns() - sample->submit_ns;
+    atomic_fetch_add(&jobs_done, 1);
+}
+
+void timed_end_job(void *arg)
+{
+    (void)arg;
+    atomic_store(&last_end_ns, now_ns());
+    atomic_fetch_add(&jobs_done, 1);
+}
+
+/**
+ * argument owned by the job, freed by it like callers without tpool_submit_job_copy have to
+ */
+void free_arg_job(void *arg)
+{
+    free(arg);
+    atomic_fetch_add(&jobs_done, 1);
+}
+
+void *producer_function(producer_args *args)
+{
+    for (size_t i = 0; i < args->jobs; i++)
+    {
+        tpool_submit_job(args->tp, empty_job, NULL);
+    }
+    return NULL;
+}
+
+/**
+ * submit jobs as fast as possible from one thread, runtime until all have run
+ */
+void bench_empty_throughput(size_t num_workers, size_t num_jobs)
+{
+    threadpool tp = tpool_create(num_workers, NULL, NULL);
+    atomic_store(&jobs_done, 0);
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        tpool_submit_job(tp, empty_job, NULL);
+    }
+    wait_for_jobs(num_jobs);
+    uint64_t end = now_ns();
+    tpool_wait(tp);
+    tpool_destroy(tp);
+
+    bench_result *result = new_result("empty_throughput", num_workers, 1);
+    result->runtime_s = (end - start) / 1e9;
+    result->jobs_per_s = num_jobs / result->runtime_s;
+}
+
+/**
+ * empty throughput with an argument of arg_size bytes per job,
+ * either malloc'd by the submitter and freed by the job or copied by tpool_submit_job_copy
+ */
+void bench_argument_passing(size_t num_workers, size_t num_jobs, size_t arg_size, bool copy)
+{
+    char workload[64];
+    unsigned char arg[4096] = {0};
+    threadpool tp = tpool_create(num_workers, NULL, NULL);
+    atomic_store(&jobs_done, 0);
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        if (copy)
+        {
+            tpool_submit_job_copy(tp, empty_job, arg, arg_size);
+        }
+        else
+        {
+            void *owned = malloc(arg_size);
+            memcpy(owned, arg, arg_size);
+            tpool_submit_job(tp, free_arg_job, owned);
+        }
+    }
+    wait_for_jobs(num_jobs);
+    uint64_t end = now_ns();
+    tpool_wait(tp);
+    tpool_destroy(tp);
+
+    snprintf(workload, sizeof(workload), "%s_arg_%zu", copy ? "copy" : "malloc", arg_size);
+    bench_result *result = new_result(workload, num_workers, 1);
+    result->runtime_s = (end - start) / 1e9;
+    result->jobs_per_s = num_jobs / result->runtime_s;
+}
+
+/**
+ * paced submits, measures time between submit and job start
+ */
+void bench_submit_latency(size_t num_workers, size_t num_jobs, uint64_t gap_us)
+{
+    threadpool tp = tpool_create(num_workers, NULL, NULL);
+    latency_sample *samples = malloc(num_jobs * sizeof(latency_sample));
+    uint64_t *deltas = malloc(num_jobs * sizeof(uint64_t));
+    atomic_store(&jobs_done, 0);
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        uint64_t next_submit = start + i * gap_us * 1000;
+        while (now_ns() < next_submit)
+            ;
+        samples[i].start_delta_ns = &deltas[i];
+        samples[i].submit_ns = now_ns();
+        tpool_submit_job(tp, latency_job, &samples[i]);
+    }
+    wait_for_jobs(num_jobs);
+    uint64_t end = now_ns();
+    tpool_wait(tp);
+    tpool_destroy(tp);
+
+    bench_result *result = new_result("submit_to_start_latency", num_workers, 1);
+    result->runtime_s = (end - start) / 1e9;
+    fill_latencies(result, deltas, num_jobs);
+    free(samples);
+    free(deltas);
+}
+
+/**
+ * lets the pool go idle before every submit, measures time until the job starts
+ */
+void bench_wakeup_latency(size_t num_workers, size_t num_samples, uint64_t idle_ms)
+{
+    threadpool tp = tpool_create(num_workers, NULL, NULL);
+    uint64_t *deltas = malloc(num_samples * sizeof(uint64_t));
+    latency_sample sample;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < num_samples; i++)
+    {
+        atomic_store(&jobs_done, 0);
+        sleep_ms(idle_ms);
+        sample.start_delta_ns = &deltas[i];
+        sample.submit_ns = now_ns();
+        tpool_submit_job(tp, latency_job, &sample);
+        wait_for_jobs(1);
+    }
+    uint64_t end = now_ns();
+    tpool_destroy(tp);
+
+    bench_result *result = new_result("wakeup_latency", num_workers, 1);
+    result->runtime_s = (end - start) / 1e9;
+    fill_latencies(result, deltas, num_samples);
+    free(deltas);
+}
+
+/**
+ * time between the last job ending and tpool_wait returning
+ */
+void bench_wait_latency(size_t num_workers, size_t num_samples, size_t jobs_per_sample)
+{
+    threadpool tp = tpool_create(num_workers, NULL, NULL);
+    uint64_t *deltas = malloc(num_samples * sizeof(uint64_t));
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < num_samples; i++)
+    {
+        atomic_store(&jobs_done, 0);
+        for (size_t j = 0; j < jobs_per_sample; j++)
+        {
+            tpool_submit_job(tp, timed_end_job, NULL);
+        }
+        tpool_wait(tp);
+        deltas[i] = now_ns() - atomic_load(&last_end_ns);
+    }
+    uint64_t end = now_ns();
+    tpool_destroy(tp);
+
+    bench_result *result = new_result("wait_latency", num_workers, 1);
+    result->runtime_s = (end - start) / 1e9;
+    fill_latencies(result, deltas, num_samples);
+    free(deltas);
+}
+
+size_t current_threads(threadpool tp)
+{
+    tpool_stats stats;
+    tpool_get_stats(tp, &stats);
+    return stats.num_threads;
+}
+
+/**
+ * time from tpool_scale until the pool reports the new thread count, up and down
+ */
+void bench_scale_reaction(size_t diff, size_t num_samples)
+{
+    // tpool_scale clamps to MAX_SIZE, a larger target would never be reached
+    if (diff > MAX_SIZE - 1)
+    {
+        diff = MAX_SIZE - 1;
+    }
+    threadpool tp = tpool_create(1, NULL, NULL);
+    uint64_t *up = malloc(num_samples * sizeof(uint64_t));
+    uint64_t *down = malloc(num_samples * sizeof(uint64_t));
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < num_samples; i++)
+    {
+        uint64_t t0 = now_ns();
+        tpool_scale(tp, (int)diff);
+        while (current_threads(tp) < 1 + diff)
+        {
+            sched_yield();
+        }
+        up[i] = now_ns() - t0;
+        t0 = now_ns();
+        tpool_scale(tp, -(int)diff);
+        while (current_threads(tp) > 1)
+        {
+            sched_yield();
+        }
+        down[i] = now_ns() - t0;
+    }
+    uint64_t end = now_ns();
+    tpool_destroy(tp);
+
+    bench_result *result = new_result("scale_up_reaction", 1 + diff, 1);
+    result->runtime_s = (end - start) / 1e9;
+    fill_latencies(result, up, num_samples);
+    result = new_result("scale_down_reaction", 1 + diff, 1);
+    result->runtime_s = (end - start) / 1e9;
+    fill_latencies(result, down, num_samples);
+    free(up);
+    free(down);
+}
+
+/**
+ * num_producers threads submit concurrently into a pool of num_workers
+ */
+void bench_producer_consumer(size_t num_workers, size_t num_producers, size_t num_jobs)
+{
+    threadpool tp = tpool_create(num_workers, NULL, NULL);
+    pthread_t producers[num_producers];
+    producer_args args = {.tp = tp, .jobs = num_jobs / num_producers};
+    size_t total = args.jobs * num_producers;
+    atomic_store(&jobs_done, 0);
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < num_producers; i++)
+    {
+        pthread_create(&producers[i], NULL, (void *(*)(void *))producer_function, &args);
+    }
+    for (size_t i = 0; i < num_producers; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    wait_for_jobs(total);
+    uint64_t end = now_ns();
+    tpool_wait(tp);
+    tpool_destroy(tp);
+
+    bench_result *result = new_result("producer_consumer", num_workers, num_producers);
+    result->runtime_s = (end - start) / 1e9;
+    result->jobs_per_s = total / result->runtime_s;
+}
+
+void write_results(FILE *out)
+{
+    fprintf(out, "[\n");
+    for (size_t i = 0; i < num_results; i++)
+    {
+        bench_result *r = &results[i];
+        fprintf(out, "    {\n");
+        fprintf(out, "        \"workload\": \"%s\",\n", r->workload);
+        fprintf(out, "        \"thread_config\": {\n");
+        fprintf(out, "            \"num_workers\": %zu,\n", r->num_workers);
+        fprintf(out, "            \"num_producers\": %zu\n", r->num_producers);
+        fprintf(out, "        },\n");
+        fprintf(out, "        \"runtime_s\": %f,\n", r->runtime_s);
+        fprintf(out, "        \"avg_latency_ms\": %f,\n", r->avg_latency_ms);
+        fprintf(out, "        \"syscall_metrics\": [],\n");
+        fprintf(out, "        \"io_throughput\": {\n");
+        fprintf(out, "            \"read_bytes\": 0,\n");
+        fprintf(out, "            \"write_bytes\": 0\n");
+        fprintf(out, "        },\n");
+        fprintf(out, "        \"iowait\": 0,\n");
+        fprintf(out, "        \"metrics\": {\n");
+        fprintf(out, "            \"p50_us\": %f,\n", r->p50_us);
+        fprintf(out, "            \"p99_us\": %f,\n", r->p99_us);
+        fprintf(out, "            \"p999_us\": %f,\n", r->p999_us);
+        fprintf(out, "            \"jobs_per_s\": %f\n", r->jobs_per_s);
+        fprintf(out, "        }\n");
+        fprintf(out, "    }%s\n", i + 1 < num_results ? "," : "");
+    }
+    fprintf(out, "]\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 4)
+    {
+        printf("args: <result_json_path> [max_threads (default 8)] [num_jobs (default 100000)]\n");
+        printf("--- result path \"-\" writes to stdout\n");
+        return -1;
+    }
+    size_t max_threads = argc > 2 ? (size_t)atoi(argv[2]) : 8;
+    size_t num_jobs = argc > 3 ? (size_t)atoi(argv[3]) : 100000;
+    if (max_threads < 1 || max_threads > MAX_SIZE || num_jobs < 1000)
+    {
+        printf("max_threads must be in [1, %d], num_jobs at least 1000\n", MAX_SIZE);
+        return -1;
+    }
+
+    for (size_t workers = 1; workers <= max_threads; workers *= 2)
+    {
+        fprintf(stderr, "empty job throughput, %zu workers\n", workers);
+        bench_empty_throughput(workers, num_jobs);
+    }
+    // node within one cache line, a typical argument struct, a large argument
+    size_t arg_sizes[] = {16, 48, 512};
+    for (size_t i = 0; i < sizeof(arg_sizes) / sizeof(arg_sizes[0]); i++)
+    {
+        fprintf(stderr, "argument passing, %zu bytes\n", arg_sizes[i]);
+        bench_argument_passing(max_threads, num_jobs, arg_sizes[i], false);
+        bench_argument_passing(max_threads, num_jobs, arg_sizes[i], true);
+    }
+    fprintf(stderr, "%s\n", "submit to start latency");
+    bench_submit_latency(max_threads, num_jobs / 10, 50);
+    fprintf(stderr, "%s\n", "wakeup latency");
+    bench_wakeup_latency(max_threads, 20, 100);
+    fprintf(stderr, "%s\n", "tpool_wait latency");
+    bench_wait_latency(max_threads, 20, 100);
+    fprintf(stderr, "%s\n", "scaling reaction");
+    bench_scale_reaction(max_threads, 5);
+    for (size_t producers = 1; producers <= max_threads; producers *= 2)
+    {
+        for (size_t workers = 1; workers <= max_threads; workers *= 2)
+        {
+            fprintf(stderr, "producer/consumer, %zu producers %zu workers\n", producers, workers);
+            bench_producer_consumer(workers, producers, num_jobs);
+        }
+    }
+
+    FILE *out = strcmp(argv[1], "-") == 0 ? stdout : fopen(argv[1], "w");
+    if (out == NULL)
+    {
+        perror("opening result file");
+        return 1;
+    }
+    write_results(out);
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "adaptive_tpool.hpp"
+
+/*
+ * usage of the C++ front end, builds every submit path of adaptive_tpool.hpp
+ * exits with 1 if a job did not run as expected
+ */
+
+static std::atomic<int> function_calls{0};
+
+static void count_call()
+{
+    function_calls++;
+}
+
+// copying may throw: submit boxes it on the heap instead of constructing it in the node
+struct throwing_copy
+{
+    std::atomic<int> *counter;
+
+    explicit throwing_copy(std::atomic<int> *c) : counter(c)
+    {
+    }
+
+    throwing_copy(const throwing_copy &other) noexcept(false) : counter(other.counter)
+    {
+    }
+
+    void operator()() const
+    {
+        (*counter)++;
+    }
+};
+
+static bool check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        printf("failed: %s\n", what);
+    }
+    return ok;
+}
+
+int main()
+{
+    adaptive_tpool::pool pool(4);
+    bool ok = true;
+
+    // plain functions, by reference and by pointer
+    void (*function_ptr)() = count_call;
+    pool.submit(count_call);
+    pool.submit(function_ptr);
+    pool.submit(&count_call);
+
+    std::atomic<int> lambda_calls{0};
+    pool.submit([&lambda_calls] { lambda_calls++; });
+    auto value = std::make_unique<int>(42);
+    pool.submit([&lambda_calls, value = std::move(value)] { lambda_calls += *value == 42; });
+
+    std::atomic<int> boxed_calls{0};
+    throwing_copy functor(&boxed_calls);
+    pool.submit(functor);
+    pool.wait();
+    ok &= check(function_calls == 3, "function submit");
+    ok &= check(lambda_calls == 2, "lambda submit");
+    ok &= check(boxed_calls == 1, "boxed submit");
+
+    std::future<int> answer = pool.async([] { return 6 * 7; });
+    ok &= check(answer.get() == 42, "async result");
+    std::future<void> failing = pool.async([] { throw std::runtime_error("expected"); });
+    try
+    {
+        failing.get();
+        ok &= check(false, "async exception");
+    }
+    catch (const std::runtime_error &)
+    {
+    }
+
+    std::vector<int> squares(1000);
+    pool.parallel_for(0, static_cast<int>(squares.size()), [&squares](int i) { squares[i] = i * i; });
+    for (int i = 0; i < static_cast<int>(squares.size()); i++)
+    {
+        if (squares[i] != i * i)
+        {
+            ok &= check(false, "parallel_for");
+            break;
+        }
+    }
+
+    if (ok)
+    {
+        printf("%s\n", "all jobs ran");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <syscall.h>
+#include <sys/resource.h>
+#include "adaptive_tpool.h"
+#include "worker_metrics.h"
+
+/*
+ * per-thread accounting from procfs and getrusage, no privileges needed
+ * every reader only covers the calling thread (thread-self, RUSAGE_THREAD)
+ */
+
+/* ==================== Prototypes ==================== */
+
+static ssize_t read_proc_file(const char *path, char *buffer, size_t size);
+
+static void parse_io(const char *content, tpool_worker_metrics *metrics);
+
+static void parse_schedstat(const char *content, tpool_worker_metrics *metrics);
+
+static void parse_stat(const char *content, tpool_worker_metrics *metrics);
+
+/* ====================== API ====================== */
+
+bool tpool_sample_thread_metrics(tpool_worker_metrics *metrics)
+{
+    char buffer[1024];
+    struct timespec spec;
+    struct rusage usage;
+    bool complete = true;
+
+    memset(metrics, 0, sizeof(tpool_worker_metrics));
+    metrics->tid = syscall(__NR_gettid);
+    clock_gettime(CLOCK_REALTIME, &spec);
+    metrics->timestamp_ms = (uint64_t)spec.tv_sec * 1000 + (uint64_t)spec.tv_nsec / 1000000;
+
+    // io accounting may be compiled out of the kernel, the other sources still count
+    if (read_proc_file("/proc/thread-self/io", buffer, sizeof(buffer)) > 0)
+        parse_io(buffer, metrics);
+    else
+        complete = false;
+    if (read_proc_file("/proc/thread-self/schedstat", buffer, sizeof(buffer)) > 0)
+        parse_schedstat(buffer, metrics);
+    else
+        complete = false;
+    if (read_proc_file("/proc/thread-self/stat", buffer, sizeof(buffer)) > 0)
+        parse_stat(buffer, metrics);
+    else
+        complete = false;
+    if (getrusage(RUSAGE_THREAD, &usage) == 0)
+    {
+        metrics->utime_us = (uint64_t)usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec;
+        metrics->stime_us = (uint64_t)usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec;
+        metrics->voluntary_ctxt_switches = usage.ru_nvcsw;
+        metrics->involuntary_ctxt_switches = usage.ru_nivcsw;
+    }
+    else
+    {
+        complete = false;
+    }
+    return complete;
+}
+
+int thread_io_open(void)
+{
+    return open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+}
+
+bool thread_io_read(int fd, tpool_worker_metrics *metrics)
+{
+    char buffer[512];
+    // procfs regenerates the content on every read from offset 0, no reopen needed
+    ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (length <= 0)
+    {
+        return false;
+    }
+    buffer[length] = '\0';
+    parse_io(buffer, metrics);
+    return true;
+}
+
+/* =================== Internal ===================== */
+
+/*
+ * reads a whole (small) procfs file and null terminates it
+ */
+static ssize_t read_proc_file(const char *path, char *buffer, size_t size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ssize_t length = read(fd, buffer, size - 1);
+    close(fd);
+    if (length < 0)
+    {
+        return -1;
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+static void parse_io(const char *content, tpool_worker_metrics *metrics)
+{
+    char key[32];
+    unsigned long long value;
+    int consumed;
+    while (sscanf(content, "%31[^:]: %llu\n%n", key, &value, &consumed) == 2)
+    {
+        if (strcmp(key, "rchar") == 0)
+            metrics->rchar = value;
+        else if (strcmp(key, "wchar") == 0)
+            metrics->wchar = value;
+        else if (strcmp(key, "syscr") == 0)
+            metrics->syscr = value;
+        else if (strcmp(key, "syscw") == 0)
+            metrics->syscw = value;
+        else if (strcmp(key, "read_bytes") == 0)
+            metrics->read_bytes = value;
+        else if (strcmp(key, "write_bytes") == 0)
+            metrics->write_bytes = value;
+        else if (strcmp(key, "cancelled_write_bytes") == 0)
+            metrics->cancelled_write_bytes = value;
+        content += consumed;
+    }
+}
+
+/*
+ * <time on cpu ns> <time waiting on a runqueue ns> <timeslices>
+ */
+static void parse_schedstat(const char *content, tpool_worker_metrics *metrics)
+{
+    unsigned long long cpu_time, run_delay, timeslices;
+    if (sscanf(content, "%llu %llu %llu", &cpu_time, &run_delay, &timeslices) == 3)
+    {
+        metrics->cpu_time_ns = cpu_time;
+        metrics->run_delay_ns = run_delay;
+        metrics->timeslices = timeslices;
+    }
+}
+
+/*
+ * only field 42 (delayacct_blkio_ticks) is used, the same value pidstat reports
+ */
+static void parse_stat(const char *content, tpool_worker_metrics *metrics)
+{
+    // comm may contain spaces, fields are counted after its closing parenthesis (field 3 onwards)
+    const char *field = strrchr(content, ')');
+    if (field == NULL)
+    {
+        return;
+    }
+    field++;
+    for (int index = 3; index < 42 && field != NULL; index++)
+    {
+        field = strchr(field + 1, ' ');
+    }
+    if (field != NULL)
+    {
+        metrics->blkio_delay_ticks = strtoull(field + 1, NULL, 10);
+    }
+}
@@ -0,0 +1,23 @@
+//
+// per-job io deltas of a worker thread, the full samples are tpool_sample_thread_metrics
+//
+
+#ifndef THREADPOOL_WORKER_METRICS_H
+#define THREADPOOL_WORKER_METRICS_H
+
+#include <stdbool.h>
+#include "adaptive_tpool.h"
+
+/**
+ * opens /proc/thread-self/io of the calling thread, the fd stays bound to it
+ * @return -1 if io accounting is unavailable
+ */
+int thread_io_open(void);
+
+/**
+ * rereads the fd, fills only the io fields of metrics
+ * @return false if the read failed, the fields are left untouched
+ */
+bool thread_io_read(int fd, tpool_worker_metrics *metrics);
+
+#endif //THREADPOOL_WORKER_METRICS_H
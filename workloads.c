@@ -0,0 +1,649 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "adaptive_tpool.h"
+#include "debug_macro.h"
+#include "workloads.h"
+
+// O_DIRECT buffers, offsets and lengths have to be aligned to the logical block size, a page covers all common devices
+#define DIRECT_ALIGNMENT 4096
+#define PATH_LENGTH 512
+
+/* ==================== Prototypes ==================== */
+
+static void worker_write_synced(void *arg);
+
+static void worker_read_buffered(void *arg);
+
+static void write_seq(void *arg);
+
+static void read_seq(void *arg);
+
+static void pread_random(void *arg);
+
+static void pwrite_random(void *arg);
+
+static void mmap_read(void *arg);
+
+static void cpu(void *arg);
+
+static void mixed(void *arg);
+
+static bool prepare_rin_files(int num_items);
+
+static bool prepare_inputs(int num_items);
+
+static bool prepare_outputs(int num_items);
+
+static bool prepare_mmap(int num_items);
+
+static void remove_outputs(int num_items);
+
+static bool parse_param(workload_params *params, const char *key, const char *value);
+
+static bool parse_number(const char *value, uint64_t *number);
+
+static bool check_direct(const char *dir);
+
+static void item_path(char *path, const char *dir, const char *prefix, int index);
+
+static int open_item(const char *path, int flags);
+
+static void *alloc_block();
+
+static uint64_t next_random(uint64_t *state);
+
+static uint64_t item_seed(int index);
+
+static uint64_t burn_cpu(uint64_t iterations, uint64_t state);
+
+static void sync_if_due(int fd, size_t writes);
+
+/* ==================== Globals ==================== */
+
+static const workload WORKLOADS[] = {
+    {"worker_write_synced", "writes a 100kb file line by line, fsync after every line (no parameters)",
+     worker_write_synced, NULL, remove_outputs, {0}},
+    {"worker_read_buffered", "reads <input_dir>/rin<i> with fgets (no parameters, see generate_files.sh)",
+     worker_read_buffered, prepare_rin_files, NULL, {0}},
+    {"write_seq", "pwrites size bytes in blocks; block, size, fsync_every, direct",
+     write_seq, prepare_outputs, remove_outputs, {.block = 4096, .size = 1 << 20, .seed = 1}},
+    {"read_seq", "preads the input file in blocks; block, size, direct",
+     read_seq, prepare_inputs, NULL, {.block = 4096, .size = 8 << 20, .seed = 1}},
+    {"pread_random", "ops block aligned preads at random offsets; block, size, ops, direct, seed",
+     pread_random, prepare_inputs, NULL, {.block = 4096, .size = 8 << 20, .ops = 256, .seed = 1}},
+    {"pwrite_random", "ops block aligned pwrites at random offsets; block, size, ops, fsync_every, direct, seed",
+     pwrite_random, prepare_outputs, remove_outputs,
+     {.block = 4096, .size = 8 << 20, .ops = 256, .fsync_every = 16, .seed = 1}},
+    {"mmap_read", "maps the input file and touches every page; size",
+     mmap_read, prepare_mmap, NULL, {.block = 4096, .size = 8 << 20, .seed = 1}},
+    {"cpu", "cpu bound loop without any i/o; cpu_iters",
+     cpu, NULL, NULL, {.block = 4096, .cpu_iters = 20000000, .seed = 1}},
+    {"mixed", "phases times a cpu burst then size/phases bytes written and fsynced; cpu_iters, phases, block, size, direct",
+     mixed, prepare_outputs, remove_outputs,
+     {.block = 4096, .size = 1 << 20, .cpu_iters = 20000000, .phases = 8, .seed = 1}},
+};
+
+static const size_t AMOUNT_WORKLOADS = sizeof(WORKLOADS) / sizeof(WORKLOADS[0]);
+
+/** set once before the pool starts, read-only for the jobs */
+static workload_params PARAMS;
+static const char *INPUT_DIR = ".";
+static const char *OUTPUT_DIR = ".";
+
+/* ====================== API ====================== */
+
+const workload *workload_parse(const char *spec)
+{
+    const char *separator = strchr(spec, ':');
+    size_t name_length = separator != NULL ? (size_t)(separator - spec) : strlen(spec);
+    const workload *selected = NULL;
+    for (size_t i = 0; i < AMOUNT_WORKLOADS; i++)
+    {
+        if (strlen(WORKLOADS[i].name) == name_length && strncmp(WORKLOADS[i].name, spec, name_length) == 0)
+        {
+            selected = &WORKLOADS[i];
+            break;
+        }
+    }
+    if (selected == NULL)
+    {
+        printf("unknown workload \"%.*s\"\n", (int)name_length, spec);
+        return NULL;
+    }
+
+    workload_params params = selected->defaults;
+    if (separator != NULL)
+    {
+        char *list = strdup(separator + 1);
+        char *saveptr = NULL;
+        for (char *pair = strtok_r(list, ",", &saveptr); pair != NULL; pair = strtok_r(NULL, ",", &saveptr))
+        {
+            char *value = strchr(pair, '=');
+            if (value == NULL)
+            {
+                printf("workload parameter \"%s\" is not <key>=<value>\n", pair);
+                free(list);
+                return NULL;
+            }
+            *value++ = '\0';
+            if (!parse_param(&params, pair, value))
+            {
+                free(list);
+                return NULL;
+            }
+        }
+        free(list);
+    }
+
+    // workloads without files have no default size
+    if (selected->defaults.size != 0 && (params.block == 0 || params.size < params.block))
+    {
+        printf("workload needs 0 < block <= size\n");
+        return NULL;
+    }
+    if (params.direct && (params.block % DIRECT_ALIGNMENT != 0 || params.size % DIRECT_ALIGNMENT != 0))
+    {
+        printf("direct needs block and size to be multiples of %d\n", DIRECT_ALIGNMENT);
+        return NULL;
+    }
+    if (params.phases == 0)
+    {
+        params.phases = 1;
+    }
+    PARAMS = params;
+    return selected;
+}
+
+void workload_set_dirs(const char *input_dir, const char *output_dir)
+{
+    INPUT_DIR = input_dir;
+    OUTPUT_DIR = output_dir;
+}
+
+void workload_print_usage()
+{
+    printf("valid worker functions (<name>[:<key>=<value>,...], sizes accept k/m/g suffixes):\n");
+    for (size_t i = 0; i < AMOUNT_WORKLOADS; i++)
+    {
+        printf("--- %s: %s\n", WORKLOADS[i].name, WORKLOADS[i].description);
+    }
+}
+
+/* =================== Internal ===================== */
+
+/**
+ * writes 100kb file line by line with fsyncing every line
+ */
+static void worker_write_synced(void *arg)
+{
+    int *valp = arg;
+    debug_print("%s %d\n", "user function start", *valp);
+    char filename[PATH_LENGTH];
+    item_path(filename, OUTPUT_DIR, "wout", *valp);
+    printf("opening file %s\n", filename);
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL)
+    {
+        printf("could not open %s: %s\n", filename, strerror(errno));
+        return;
+    }
+    int fd = fileno(fp);
+    // roughly 100Kb
+    for (int i = 0; i < 7000; ++i)
+    {
+        fputs("this is a line\n", fp);
+        fsync(fd);
+    }
+    fclose(fp);
+    debug_print("%s %d\n", "user function end", *valp);
+}
+
+/**
+ * reads an input file line by line using a single 4kb buffer
+ */
+static void worker_read_buffered(void *arg)
+{
+    int *valp = arg;
+    char filename[PATH_LENGTH];
+    char buffer[4096];
+    debug_print("%s %d\n", "buffered read function start", *valp);
+    item_path(filename, INPUT_DIR, "rin", *valp);
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL)
+    {
+        printf("could not open %s: %s\n", filename, strerror(errno));
+        return;
+    }
+    while (fgets(buffer, 4096, fp) != NULL)
+    {
+        debug_print("%s %d\n", "buffered read", *valp);
+    }
+    fclose(fp);
+    debug_print("%s %d\n", "buffered read function end", *valp);
+}
+
+static void write_seq(void *arg)
+{
+    int index = *(int *)arg;
+    char filename[PATH_LENGTH];
+    item_path(filename, OUTPUT_DIR, "wout", index);
+    int fd = open_item(filename, O_WRONLY | O_CREAT | O_TRUNC);
+    void *block = alloc_block();
+    if (fd < 0 || block == NULL)
+    {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    memset(block, 'w', PARAMS.block);
+    size_t writes = 0;
+    for (size_t offset = 0; offset + PARAMS.block <= PARAMS.size; offset += PARAMS.block)
+    {
+        pwrite(fd, block, PARAMS.block, offset);
+        sync_if_due(fd, ++writes);
+    }
+    close(fd);
+}
+
+static void read_seq(void *arg)
+{
+    int index = *(int *)arg;
+    char filename[PATH_LENGTH];
+    item_path(filename, INPUT_DIR, "win", index);
+    int fd = open_item(filename, O_RDONLY);
+    void *block = alloc_block();
+    if (fd < 0 || block == NULL)
+    {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    for (size_t offset = 0; offset + PARAMS.block <= PARAMS.size; offset += PARAMS.block)
+    {
+        if (pread(fd, block, PARAMS.block, offset) <= 0)
+        {
+            break;
+        }
+    }
+    close(fd);
+}
+
+/*
+ * every item reads its own file so the offsets of one job do not warm the cache for another
+ */
+static void pread_random(void *arg)
+{
+    int index = *(int *)arg;
+    char filename[PATH_LENGTH];
+    item_path(filename, INPUT_DIR, "win", index);
+    int fd = open_item(filename, O_RDONLY);
+    void *block = alloc_block();
+    if (fd < 0 || block == NULL)
+    {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    uint64_t state = item_seed(index);
+    size_t slots = PARAMS.size / PARAMS.block;
+    for (size_t i = 0; i < PARAMS.ops; i++)
+    {
+        pread(fd, block, PARAMS.block, (next_random(&state) % slots) * PARAMS.block);
+    }
+    close(fd);
+}
+
+static void pwrite_random(void *arg)
+{
+    int index = *(int *)arg;
+    char filename[PATH_LENGTH];
+    item_path(filename, OUTPUT_DIR, "wout", index);
+    int fd = open_item(filename, O_WRONLY | O_CREAT | O_TRUNC);
+    void *block = alloc_block();
+    if (fd < 0 || block == NULL)
+    {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    memset(block, 'w', PARAMS.block);
+    // sparse, the writes allocate the blocks they hit
+    ftruncate(fd, PARAMS.size);
+    uint64_t state = item_seed(index);
+    size_t slots = PARAMS.size / PARAMS.block;
+    for (size_t i = 0; i < PARAMS.ops; i++)
+    {
+        pwrite(fd, block, PARAMS.block, (next_random(&state) % slots) * PARAMS.block);
+        sync_if_due(fd, i + 1);
+    }
+    close(fd);
+}
+
+/*
+ * page faults instead of read calls: the i/o shows up as major faults and blkio delay, not as syscalls
+ */
+static void mmap_read(void *arg)
+{
+    int index = *(int *)arg;
+    char filename[PATH_LENGTH];
+    item_path(filename, INPUT_DIR, "win", index);
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("could not open %s: %s\n", filename, strerror(errno));
+        return;
+    }
+    unsigned char *data = mmap(NULL, PARAMS.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        printf("could not map %s: %s\n", filename, strerror(errno));
+        return;
+    }
+    long page_size = sysconf(_SC_PAGESIZE);
+    volatile uint64_t sum = 0;
+    for (size_t offset = 0; offset < PARAMS.size; offset += page_size)
+    {
+        sum += data[offset];
+    }
+    munmap(data, PARAMS.size);
+}
+
+static void cpu(void *arg)
+{
+    int index = *(int *)arg;
+    volatile uint64_t result = burn_cpu(PARAMS.cpu_iters, item_seed(index));
+    (void)result;
+}
+
+/*
+ * cpu bound and i/o bound phases alternate inside every job, so the busy threads are never all blocked
+ */
+static void mixed(void *arg)
+{
+    int index = *(int *)arg;
+    char filename[PATH_LENGTH];
+    item_path(filename, OUTPUT_DIR, "wout", index);
+    int fd = open_item(filename, O_WRONLY | O_CREAT | O_TRUNC);
+    void *block = alloc_block();
+    if (fd < 0 || block == NULL)
+    {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    memset(block, 'm', PARAMS.block);
+    uint64_t state = item_seed(index);
+    size_t blocks_per_phase = PARAMS.size / PARAMS.block / PARAMS.phases;
+    size_t offset = 0;
+    for (size_t phase = 0; phase < PARAMS.phases; phase++)
+    {
+        state = burn_cpu(PARAMS.cpu_iters / PARAMS.phases, state);
+        for (size_t i = 0; i < blocks_per_phase; i++)
+        {
+            pwrite(fd, block, PARAMS.block, offset);
+            offset += PARAMS.block;
+        }
+        fsync(fd);
+    }
+    volatile uint64_t result = state;
+    (void)result;
+    close(fd);
+}
+
+/*
+ * the rin files are made by generate_files.sh, only their presence is checked
+ */
+static bool prepare_rin_files(int num_items)
+{
+    char filename[PATH_LENGTH];
+    for (int i = 0; i < num_items; i++)
+    {
+        item_path(filename, INPUT_DIR, "rin", i);
+        if (access(filename, R_OK) != 0)
+        {
+            printf("input file %s is missing, run generate_files.sh first\n", filename);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * creates the win files that are missing or too small, they are kept for later runs
+ * new files are dropped from the page cache so the first run does not read from memory
+ */
+static bool prepare_inputs(int num_items)
+{
+    if (PARAMS.direct && !check_direct(INPUT_DIR))
+    {
+        return false;
+    }
+    char filename[PATH_LENGTH];
+    size_t chunk_size = 1 << 20;
+    unsigned char *chunk = malloc(chunk_size);
+    uint64_t state = PARAMS.seed | 1;
+    for (size_t i = 0; i < chunk_size; i += sizeof(uint64_t))
+    {
+        uint64_t value = next_random(&state);
+        memcpy(chunk + i, &value, sizeof(value));
+    }
+    for (int i = 0; i < num_items; i++)
+    {
+        struct stat info;
+        item_path(filename, INPUT_DIR, "win", i);
+        if (stat(filename, &info) == 0 && (size_t)info.st_size >= PARAMS.size)
+        {
+            continue;
+        }
+        int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            printf("could not create %s: %s\n", filename, strerror(errno));
+            free(chunk);
+            return false;
+        }
+        for (size_t written = 0; written < PARAMS.size;)
+        {
+            size_t length = PARAMS.size - written < chunk_size ? PARAMS.size - written : chunk_size;
+            ssize_t result = write(fd, chunk, length);
+            if (result <= 0)
+            {
+                printf("could not write %s: %s\n", filename, strerror(errno));
+                close(fd);
+                free(chunk);
+                return false;
+            }
+            written += result;
+        }
+        fsync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    free(chunk);
+    return true;
+}
+
+static bool prepare_outputs(int num_items)
+{
+    (void)num_items;
+    return !PARAMS.direct || check_direct(OUTPUT_DIR);
+}
+
+static bool prepare_mmap(int num_items)
+{
+    if (PARAMS.direct)
+    {
+        printf("mmap_read does not support direct\n");
+        return false;
+    }
+    return prepare_inputs(num_items);
+}
+
+static void remove_outputs(int num_items)
+{
+    char filename[PATH_LENGTH];
+    debug_print("%s\n", "deleting worker output");
+    for (int i = 0; i < num_items; i++)
+    {
+        item_path(filename, OUTPUT_DIR, "wout", i);
+        remove(filename);
+    }
+}
+
+static bool parse_param(workload_params *params, const char *key, const char *value)
+{
+    uint64_t number;
+    if (!parse_number(value, &number))
+    {
+        printf("workload parameter %s: \"%s\" is not a number\n", key, value);
+        return false;
+    }
+    if (strcmp(key, "block") == 0)
+        params->block = number;
+    else if (strcmp(key, "size") == 0)
+        params->size = number;
+    else if (strcmp(key, "ops") == 0)
+        params->ops = number;
+    else if (strcmp(key, "fsync_every") == 0)
+        params->fsync_every = number;
+    else if (strcmp(key, "direct") == 0)
+        params->direct = number != 0;
+    else if (strcmp(key, "cpu_iters") == 0)
+        params->cpu_iters = number;
+    else if (strcmp(key, "phases") == 0)
+        params->phases = number;
+    else if (strcmp(key, "seed") == 0)
+        params->seed = number;
+    else
+    {
+        printf("unknown workload parameter \"%s\"\n", key);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * decimal with an optional binary k/m/g suffix
+ */
+static bool parse_number(const char *value, uint64_t *number)
+{
+    char *end;
+    errno = 0;
+    unsigned long long parsed = strtoull(value, &end, 10);
+    if (errno != 0 || end == value)
+    {
+        return false;
+    }
+    switch (*end)
+    {
+    case 'g':
+    case 'G':
+        parsed <<= 10;
+        // fall through
+    case 'm':
+    case 'M':
+        parsed <<= 10;
+        // fall through
+    case 'k':
+    case 'K':
+        parsed <<= 10;
+        end++;
+        break;
+    default:
+        break;
+    }
+    *number = parsed;
+    return *end == '\0';
+}
+
+/*
+ * tmpfs and some network filesystems reject O_DIRECT with EINVAL at open
+ */
+static bool check_direct(const char *dir)
+{
+    char filename[PATH_LENGTH];
+    snprintf(filename, sizeof(filename), "%s/.direct_check", dir);
+    int fd = open(filename, O_WRONLY | O_CREAT | O_DIRECT, 0644);
+    if (fd < 0)
+    {
+        printf("O_DIRECT is not supported in %s: %s\n", dir, strerror(errno));
+        return false;
+    }
+    close(fd);
+    remove(filename);
+    return true;
+}
+
+static void item_path(char *path, const char *dir, const char *prefix, int index)
+{
+    snprintf(path, PATH_LENGTH, "%s/%s%d", dir, prefix, index);
+}
+
+static int open_item(const char *path, int flags)
+{
+    int fd = open(path, flags | (PARAMS.direct ? O_DIRECT : 0), 0644);
+    if (fd < 0)
+    {
+        printf("could not open %s: %s\n", path, strerror(errno));
+    }
+    return fd;
+}
+
+/*
+ * from the worker's arena, the pool reclaims it when the job returns
+ */
+static void *alloc_block()
+{
+    void *block = tpool_arena_alloc(PARAMS.block, DIRECT_ALIGNMENT);
+    if (block == NULL)
+    {
+        printf("could not allocate a %zu byte block\n", PARAMS.block);
+    }
+    return block;
+}
+
+/*
+ * xorshift64, state must not be 0
+ */
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static uint64_t item_seed(int index)
+{
+    return (PARAMS.seed ^ ((uint64_t)(index + 1) * 0x9e3779b97f4a7c15ULL)) | 1;
+}
+
+/*
+ * dependent chain, the compiler can neither vectorize nor drop it
+ */
+static uint64_t burn_cpu(uint64_t iterations, uint64_t state)
+{
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        next_random(&state);
+    }
+    return state;
+}
+
+static void sync_if_due(int fd, size_t writes)
+{
+    if (PARAMS.fsync_every != 0 && writes % PARAMS.fsync_every == 0)
+    {
+        fsync(fd);
+    }
+}
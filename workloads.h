@@ -0,0 +1,60 @@
+//
+// parameterized jobs for benchmark.c, selected by a spec string:
+//   <name>[:<key>=<value>,...]   e.g. "pread_random:block=4096,ops=512,direct=1"
+// every job gets a pointer to its item index, item i uses the files <dir>/win<i> (input) and <dir>/wout<i> (output)
+//
+
+#ifndef THREADPOOL_WORKLOADS_H
+#define THREADPOOL_WORKLOADS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct workload_params
+{
+    /** bytes per read/write call */
+    size_t block;
+    /** bytes per item file */
+    size_t size;
+    /** accesses per job of the random workloads */
+    size_t ops;
+    /** writes between two fsyncs, 0: never */
+    size_t fsync_every;
+    /** open the item files with O_DIRECT, block and size must then be multiples of 4096 */
+    bool direct;
+    /** length of the cpu bound part of a job */
+    uint64_t cpu_iters;
+    /** mixed: amount of alternating cpu and write phases */
+    size_t phases;
+    uint64_t seed;
+} workload_params;
+
+typedef struct workload
+{
+    const char *name;
+    const char *description;
+    /** job function, arg is an int * item index */
+    void (*run)(void *arg);
+    /** creates missing input files before the pool starts, NULL if none are needed */
+    bool (*prepare)(int num_items);
+    /** removes the output files of the jobs */
+    void (*cleanup)(int num_items);
+    workload_params defaults;
+} workload;
+
+/**
+ * looks up a workload and sets the parameters for all later jobs
+ * @return NULL after printing the reason if the name or a parameter is invalid
+ */
+const workload *workload_parse(const char *spec);
+
+/**
+ * @param input_dir: directory of the input files, shared by parallel benchmark processes
+ * @param output_dir: directory the jobs write to
+ */
+void workload_set_dirs(const char *input_dir, const char *output_dir);
+
+void workload_print_usage();
+
+#endif //THREADPOOL_WORKLOADS_H